@@ -35,6 +35,16 @@ extern "C" {
 enum FONTflags {
 	FONT_ZERO_TOPLEFT = 1,
 	FONT_ZERO_BOTTOMLEFT = 2,
+	// Rasterize and blur glyphs with large blur at reduced resolution, the quads are scaled up to the requested size.
+	FONT_LOWRES_BLUR = 4,
+	// Store glyphs as signed distance fields at FONT_SDF_SIZE, the quads are scaled to the requested size.
+	// The atlas needs to be drawn with a distance field shader, and blur is ignored.
+	FONT_SDF = 8,
+	// Flatten the GPOS pair kerning tables into lookup arrays when fonts are added (stb_truetype only).
+	FONT_FLATTEN_KERNING = 16,
+	// Read and parse fonts when they are first needed to draw or measure text, not when they are added.
+	// fontAddFont then does not report files that cannot be loaded, such fonts draw nothing.
+	FONT_LAZY_LOAD = 32,
 };
 
 enum FONTalign {
@@ -49,6 +59,16 @@ enum FONTalign {
 	FONT_ALIGN_BASELINE	= 1<<6, // Default
 };
 
+enum FONTsizePolicy {
+	// Rasterize glyphs at the requested size (default).
+	FONT_SIZE_EXACT = 0,
+	// Rasterize at the smallest bucket size that is at least the requested size,
+	// or at the requested size when it is larger than all the buckets.
+	FONT_SIZE_BUCKETS = 1,
+	// Rasterize at the next power of sqrt(2) size.
+	FONT_SIZE_SQRT2 = 2,
+};
+
 enum FONTerrorCode {
 	// Font atlas is full.
 	FONT_ATLAS_FULL = 1,
@@ -60,6 +80,20 @@ enum FONTerrorCode {
 	FONT_STATES_UNDERFLOW = 4,
 };
 
+// Distance field effects for a batch of vertices, see FONTparams.renderEffect.
+struct FONTeffect {
+	float dilate;			// Grows the glyph shape by this many pixels.
+	float softness;			// Width of the soft edge in pixels.
+	float outlineWidth;		// Width of the outline in pixels, 0 for no outline.
+	unsigned int outlineColor;
+};
+typedef struct FONTeffect FONTeffect;
+
+// Fonts added to the contexts created with the same registry share the font data and the tables parsed from it.
+// Contexts with a different FONT_FLATTEN_KERNING flag load their own copy of the font.
+// Contexts sharing a registry must not be used from several threads at the same time.
+typedef struct FONTregistry FONTregistry;
+
 struct FONTparams {
 	int width, height;
 	unsigned char flags;
@@ -69,6 +103,14 @@ struct FONTparams {
 	void (*renderUpdate)(void* uptr, int* rect, const unsigned char* data);
 	void (*renderDraw)(void* uptr, const float* verts, const float* tcoords, const unsigned int* colors, int nverts);
 	void (*renderDelete)(void* uptr);
+	// Optional, called with the effect to apply to the following renderDraw calls when it changes (FONT_SDF only).
+	void (*renderEffect)(void* uptr, const FONTeffect* effect);
+	// Optional, lets fontPrefetchText rasterize glyphs on several threads (FreeType only). Runs job(arg, index, worker)
+	// for every index in [0,count) over 'workers' threads, worker in [0,workers) tells the thread, and returns when all are done.
+	int workers;
+	void (*runParallel)(void* uptr, void (*job)(void* arg, int index, int worker), void* arg, int count);
+	// Optional, shares the fonts with the other contexts created with the registry, see fontCreateRegistry().
+	FONTregistry* registry;
 };
 typedef struct FONTparams FONTparams;
 
@@ -79,16 +121,28 @@ struct FONTquad
 };
 typedef struct FONTquad FONTquad;
 
+// Glyph of a pre-shaped run, the glyph index is in the current font and the values are in pixels.
+// Y grows down like with FONT_ZERO_TOPLEFT, with FONT_ZERO_BOTTOMLEFT the y values are negated.
+struct FONTglyphPos {
+	unsigned int index;
+	float xadvance, yadvance;	// Pen movement after the glyph.
+	float xoffset, yoffset;		// Offset of the glyph from the pen position.
+};
+typedef struct FONTglyphPos FONTglyphPos;
+
 struct FONTtextIter {
 	float x, y, nextx, nexty, scale, spacing;
 	unsigned int codepoint;
 	short isize, iblur;
 	struct FONTfont* font;
 	int prevGlyphIndex;
+	unsigned int prevCodepoint;
 	const char* str;
 	const char* next;
 	const char* end;
 	unsigned int utf8state;
+	int ascii;
+	int encoding;
 };
 typedef struct FONTtextIter FONTtextIter;
 
@@ -98,6 +152,10 @@ typedef struct FONTcontext FONTcontext;
 FONT_DEF FONTcontext* fontCreateInternal(FONTparams* params);
 FONT_DEF void fontDeleteInternal(FONTcontext* s);
 
+// Shared font registry, freed when it is deleted and the contexts using it are deleted.
+FONT_DEF FONTregistry* fontCreateRegistry(void);
+FONT_DEF void fontDeleteRegistry(FONTregistry* registry);
+
 FONT_DEF void fontSetErrorCallback(FONTcontext* s, void (*callback)(void* uptr, int error, int val), void* uptr);
 // Returns current atlas size.
 FONT_DEF void fontGetAtlasSize(FONTcontext* s, int* width, int* height);
@@ -105,8 +163,13 @@ FONT_DEF void fontGetAtlasSize(FONTcontext* s, int* width, int* height);
 FONT_DEF int fontExpandAtlas(FONTcontext* s, int width, int height);
 // Resets the whole stash.
 FONT_DEF int fontResetAtlas(FONTcontext* stash, int width, int height);
+// Sets how sizes are snapped before rasterizing, see FONTsizePolicy. The quads and advances
+// are scaled to the requested size. Buckets are sizes in pixels in increasing order, used by FONT_SIZE_BUCKETS.
+// Returns 0 and keeps the current policy if the policy or the buckets are invalid.
+FONT_DEF int fontSetSizePolicy(FONTcontext* s, int policy, const float* buckets, int nbuckets);
 
 // Add fonts
+// With FONT_USE_MMAP defined, font files are memory mapped instead of read (POSIX only), and unmapped with the context.
 FONT_DEF int fontAddFont(FONTcontext* s, const char* name, const char* path);
 FONT_DEF int fontAddFontMem(FONTcontext* s, const char* name, unsigned char* data, int ndata, int freeData);
 FONT_DEF int fontGetFontByName(FONTcontext* s, const char* name);
@@ -124,17 +187,37 @@ FONT_DEF void fontSetSpacing(FONTcontext* s, float spacing);
 FONT_DEF void fontSetBlur(FONTcontext* s, float blur);
 FONT_DEF void fontSetAlign(FONTcontext* s, int align);
 FONT_DEF void fontSetFont(FONTcontext* s, int font);
+// Outline around the glyphs, drawn by the renderer from the distance field (FONT_SDF only).
+FONT_DEF void fontSetOutline(FONTcontext* s, float width, unsigned int color);
+// Drop shadow drawn under the text by fontDrawText. With FONT_SDF the softness is applied by the renderer,
+// otherwise the shadow glyphs are blurred by softness.
+FONT_DEF void fontSetShadow(FONTcontext* s, float dx, float dy, float softness, unsigned int color);
 
 // Draw text
 FONT_DEF float fontDrawText(FONTcontext* s, float x, float y, const char* string, const char* end);
+// Rasterizes the glyphs that drawing the text with the current state needs and are not in the atlas yet,
+// in parallel when FONTparams.runParallel is set. Returns the number of glyphs added to the atlas.
+FONT_DEF int fontPrefetchText(FONTcontext* s, const char* string, const char* end);
 
 // Measure text
 FONT_DEF float fontTextBounds(FONTcontext* s, float x, float y, const char* string, const char* end, float* bounds);
+// UTF-16 and UTF-32 text in native byte order, end can be NULL for zero terminated strings.
+// Unpaired surrogates and values outside the Unicode range are drawn as U+FFFD.
+FONT_DEF float fontDrawText16(FONTcontext* s, float x, float y, const unsigned short* string, const unsigned short* end);
+FONT_DEF float fontDrawText32(FONTcontext* s, float x, float y, const unsigned int* string, const unsigned int* end);
+FONT_DEF float fontTextBounds16(FONTcontext* s, float x, float y, const unsigned short* string, const unsigned short* end, float* bounds);
+FONT_DEF float fontTextBounds32(FONTcontext* s, float x, float y, const unsigned int* string, const unsigned int* end, float* bounds);
+// Pre-shaped glyph runs, drawn without kerning and letter spacing.
+FONT_DEF float fontDrawGlyphs(FONTcontext* s, float x, float y, const FONTglyphPos* glyphs, int nglyphs);
+FONT_DEF float fontGlyphBounds(FONTcontext* s, float x, float y, const FONTglyphPos* glyphs, int nglyphs, float* bounds);
 FONT_DEF void fontLineBounds(FONTcontext* s, float y, float* miny, float* maxy);
 FONT_DEF void fontVertMetrics(FONTcontext* s, float* ascender, float* descender, float* lineh);
 
 // Text iterator
 FONT_DEF int fontTextIterInit(FONTcontext* stash, FONTtextIter* iter, float x, float y, const char* str, const char* end);
+// For UTF-16 and UTF-32 iterators str, next and end point into the original string.
+FONT_DEF int fontTextIterInit16(FONTcontext* stash, FONTtextIter* iter, float x, float y, const unsigned short* str, const unsigned short* end);
+FONT_DEF int fontTextIterInit32(FONTcontext* stash, FONTtextIter* iter, float x, float y, const unsigned int* str, const unsigned int* end);
 FONT_DEF int fontTextIterNext(FONTcontext* stash, FONTtextIter* iter, struct FONTquad* quad);
 
 // Pull texture changes
@@ -155,21 +238,94 @@ FONT_DEF void fontDrawDebug(FONTcontext* s, float x, float y);
 
 #define FONT_NOTUSED(v)  (void)sizeof(v)
 
+// SIMD code paths are picked from the compiler's target flags, define FONT_NO_SIMD to force the scalar code.
+#ifndef FONT_NO_SIMD
+#	if defined(__AVX2__)
+#		define FONT_SIMD_AVX2
+#	endif
+#	if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#		define FONT_SIMD_SSE2
+#	endif
+#	if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#		define FONT_SIMD_NEON
+#	endif
+#endif
+
+#if defined(FONT_SIMD_AVX2)
+#	include <immintrin.h>
+#elif defined(FONT_SIMD_SSE2)
+#	include <emmintrin.h>
+#endif
+#ifdef FONT_SIMD_NEON
+#	include <arm_neon.h>
+#endif
+
+// Mapped font files are paged in on demand and shared with other processes through the page cache.
+#if defined(FONT_USE_MMAP) && !defined(_WIN32)
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	define FONT_MMAP
+#endif
+
+// Code points first..last map to glyphs starting at glyph, or all to glyph when constant is set.
+struct FONTcmapRange {
+	unsigned int first, last;
+	int glyph;
+	int constant;
+};
+typedef struct FONTcmapRange FONTcmapRange;
+
 #ifdef FONT_USE_FREETYPE
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_ADVANCES_H
+#include FT_MODULE_H
+#include FT_SIZES_H
+#include FT_OUTLINE_H
 #include <math.h>
 
+// FreeType 2.10 and later set the bitmap box when an outline is loaded, so the glyph can be
+// rendered straight into the atlas instead of into the glyph slot.
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 10)
+#	define FONT_FT_RENDER_IN_PLACE
+#endif
+
+// Sizes are kept as FT_Size objects so that switching between them does not scale the font again.
+#ifndef FONT_FT_SIZE_CACHE
+#	define FONT_FT_SIZE_CACHE 8
+#endif
+
+struct FONTftSize {
+	FT_Size size;
+	FT_UInt pixels;
+	unsigned int used;		// Stamp of the last use, the oldest is replaced.
+};
+typedef struct FONTftSize FONTftSize;
+
 struct FONTttFontImpl {
 	FT_Face font;
+	FONTftSize sizes[FONT_FT_SIZE_CACHE];
+	int nsizes;
+	int active;				// Index of the active size, -1 if none.
+	unsigned int stamp;
 };
 typedef struct FONTttFontImpl FONTttFontImpl;
 
 static FT_Library ftLibrary;
 
-static int font__tt_init()
+// Glyphs can be rasterized on worker threads, each worker has its own library and faces
+// since FreeType objects must not be used from several threads at once.
+#define FONT_TT_WORKERS
+
+struct FONTttWorker {
+	FT_Library library;
+};
+typedef struct FONTttWorker FONTttWorker;
+
+static int font__tt_init(FONTcontext *context)
 {
 	FT_Error ftError;
 	FONT_NOTUSED(context);
@@ -177,16 +333,115 @@ static int font__tt_init()
 	return ftError == 0;
 }
 
-static int font__tt_loadFont(FONTcontext *context, FONTttFontImpl *font, unsigned char *data, int dataSize)
+static int font__tt_openFace(FT_Library library, FONTttFontImpl *font, unsigned char *data, int dataSize)
 {
 	FT_Error ftError;
-	FONT_NOTUSED(context);
+	font->nsizes = 0;
+	font->active = -1;
+	font->stamp = 0;
+	ftError = FT_New_Memory_Face(library, (const FT_Byte*)data, dataSize, 0, &font->font);
+	return ftError == 0;
+}
 
+static int font__tt_loadFont(FONTcontext *context, FONTttFontImpl *font, unsigned char *data, int dataSize)
+{
+	FONT_NOTUSED(context);
 	//font->font.userdata = stash;
-	ftError = FT_New_Memory_Face(ftLibrary, (const FT_Byte*)data, dataSize, 0, &font->font);
+	return font__tt_openFace(ftLibrary, font, data, dataSize);
+}
+
+static void font__tt_setContext(FONTttFontImpl *font, FONTcontext *context)
+{
+	FONT_NOTUSED(font);
+	FONT_NOTUSED(context);
+}
+
+static int font__tt_initWorker(FONTttWorker *worker)
+{
+	FT_Error ftError = FT_Init_FreeType(&worker->library);
 	return ftError == 0;
 }
 
+static void font__tt_freeWorker(FONTttWorker *worker)
+{
+	// The faces of the worker need to be freed first.
+	if (worker->library != NULL)
+		FT_Done_FreeType(worker->library);
+	worker->library = NULL;
+}
+
+// Opens the font for a worker, over the same font data.
+static int font__tt_loadWorkerFont(FONTttWorker *worker, FONTttFontImpl *font, unsigned char *data, int dataSize)
+{
+	return font__tt_openFace(worker->library, font, data, dataSize);
+}
+
+static int font__tt_isLoaded(FONTttFontImpl *font)
+{
+	return font->font != NULL;
+}
+
+// Activates the size for the pixel height, returns the pixels per em, or 0 on failure.
+static FT_UInt font__tt_setSize(FONTttFontImpl *font, float size)
+{
+	FT_UInt pixels = (FT_UInt)(size * (float)font->font->units_per_EM / (float)(font->font->ascender - font->font->descender));
+	FONTftSize* s;
+	int i;
+
+	font->stamp++;
+	if (font->active != -1 && font->sizes[font->active].pixels == pixels) {
+		font->sizes[font->active].used = font->stamp;
+		return pixels;
+	}
+	for (i = 0; i < font->nsizes; i++) {
+		if (font->sizes[i].pixels == pixels) {
+			if (FT_Activate_Size(font->sizes[i].size)) return 0;
+			font->sizes[i].used = font->stamp;
+			font->active = i;
+			return pixels;
+		}
+	}
+
+	// Add a size, or reuse the least recently used one.
+	if (font->nsizes < FONT_FT_SIZE_CACHE) {
+		FT_Size ftSize;
+		if (FT_New_Size(font->font, &ftSize)) return 0;
+		i = font->nsizes++;
+		font->sizes[i].size = ftSize;
+	} else {
+		i = 0;
+		for (s = font->sizes; s != font->sizes + font->nsizes; s++)
+			if (s->used < font->sizes[i].used)
+				i = (int)(s - font->sizes);
+	}
+	s = &font->sizes[i];
+	s->pixels = 0;
+	font->active = -1;
+	if (FT_Activate_Size(s->size)) return 0;
+	font->active = i;
+	if (FT_Set_Pixel_Sizes(font->font, 0, pixels)) return 0;
+	s->pixels = pixels;
+	s->used = font->stamp;
+	return pixels;
+}
+
+static int font__tt_flattenKerning(FONTttFontImpl *font)
+{
+	// FT_Get_Kerning() only reads the kern table.
+	FONT_NOTUSED(font);
+	return 1;
+}
+
+static void font__tt_freeFont(FONTttFontImpl *font)
+{
+	// The sizes are freed with the face.
+	if (font->font != NULL)
+		FT_Done_Face(font->font);
+	font->font = NULL;
+	font->nsizes = 0;
+	font->active = -1;
+}
+
 static void font__tt_getFontVMetrics(FONTttFontImpl *font, int *ascent, int *descent, int *lineGap)
 {
 	*ascent = font->font->ascender;
@@ -204,22 +459,58 @@ static int font__tt_getGlyphIndex(FONTttFontImpl *font, int codepoint)
 	return FT_Get_Char_Index(font->font, codepoint);
 }
 
+// Lists the mapped code points above the BMP, returns 0 on failure.
+static int font__tt_getCmapRanges(FONTttFontImpl *font, FONTcmapRange** ranges, int* nranges)
+{
+	FT_UInt glyph;
+	FT_ULong codepoint = FT_Get_Next_Char(font->font, 0xffff, &glyph);
+	int cranges = 0;
+	*ranges = NULL;
+	*nranges = 0;
+	while (glyph != 0) {
+		FONTcmapRange* range = *nranges > 0 ? &(*ranges)[*nranges-1] : NULL;
+		if (range != NULL && codepoint == range->last+1 && (int)glyph == range->glyph + (int)(codepoint - range->first)) {
+			range->last = (unsigned int)codepoint;
+		} else {
+			if (*nranges+1 > cranges) {
+				FONTcmapRange* r;
+				cranges = cranges == 0 ? 32 : cranges * 2;
+				r = (FONTcmapRange*)realloc(*ranges, sizeof(FONTcmapRange) * cranges);
+				if (r == NULL) {
+					free(*ranges);
+					*ranges = NULL;
+					*nranges = 0;
+					return 0;
+				}
+				*ranges = r;
+			}
+			range = &(*ranges)[(*nranges)++];
+			range->first = range->last = (unsigned int)codepoint;
+			range->glyph = (int)glyph;
+			range->constant = 0;
+		}
+		codepoint = FT_Get_Next_Char(font->font, codepoint, &glyph);
+	}
+	return 1;
+}
+
 static int font__tt_buildGlyphBitmap(FONTttFontImpl *font, int glyph, float size, float scale,
 							  int *advance, int *lsb, int *x0, int *y0, int *x1, int *y1)
 {
 	FT_Error ftError;
 	FT_GlyphSlot ftGlyph;
-	FT_Fixed advFixed;
 	FONT_NOTUSED(scale);
 
-	ftError = FT_Set_Pixel_Sizes(font->font, 0, (FT_UInt)(size * (float)font->font->units_per_EM / (float)(font->font->ascender - font->font->descender)));
-	if (ftError) return 0;
-	ftError = FT_Load_Glyph(font->font, glyph, FT_LOAD_RENDER);
-	if (ftError) return 0;
-	ftError = FT_Get_Advance(font->font, glyph, FT_LOAD_NO_SCALE, &advFixed);
+	if (font__tt_setSize(font, size) == 0) return 0;
+	// The linear advance is in font units with FT_LOAD_LINEAR_DESIGN, same as FT_Get_Advance() with FT_LOAD_NO_SCALE.
+#ifdef FONT_FT_RENDER_IN_PLACE
+	ftError = FT_Load_Glyph(font->font, glyph, FT_LOAD_DEFAULT | FT_LOAD_LINEAR_DESIGN);
+#else
+	ftError = FT_Load_Glyph(font->font, glyph, FT_LOAD_RENDER | FT_LOAD_LINEAR_DESIGN);
+#endif
 	if (ftError) return 0;
 	ftGlyph = font->font->glyph;
-	*advance = (int)advFixed;
+	*advance = (int)ftGlyph->linearHoriAdvance;
 	*lsb = (int)ftGlyph->metrics.horiBearingX;
 	*x0 = ftGlyph->bitmap_left;
 	*x1 = *x0 + ftGlyph->bitmap.width;
@@ -232,26 +523,99 @@ static void font__tt_renderGlyphBitmap(FONTttFontImpl *font, unsigned char *outp
 								float scaleX, float scaleY, int glyph)
 {
 	FT_GlyphSlot ftGlyph = font->font->glyph;
-	int ftGlyphOffset = 0;
-	int x, y;
-	FONT_NOTUSED(outWidth);
-	FONT_NOTUSED(outHeight);
+	FT_Bitmap* bitmap = &ftGlyph->bitmap;
+	const unsigned char* src = bitmap->buffer;
+	int y, w = (int)bitmap->width, h = (int)bitmap->rows;
 	FONT_NOTUSED(scaleX);
 	FONT_NOTUSED(scaleY);
 	FONT_NOTUSED(glyph);	// glyph has already been loaded by font__tt_buildGlyphBitmap
 
-	for ( y = 0; y < ftGlyph->bitmap.rows; y++ ) {
-		for ( x = 0; x < ftGlyph->bitmap.width; x++ ) {
-			output[(y * outStride) + x] = ftGlyph->bitmap.buffer[ftGlyphOffset++];
-		}
+#ifdef FONT_FT_RENDER_IN_PLACE
+	if (ftGlyph->format == FT_GLYPH_FORMAT_OUTLINE) {
+		// Render into the atlas rect, which is cleared. Bitmap rows go down, so the outline
+		// is moved to put the bottom left corner of the bitmap box at the origin.
+		FT_Bitmap target;
+		if (w > outWidth || h > outHeight) return;
+		memset(&target, 0, sizeof(target));
+		target.rows = (unsigned int)h;
+		target.width = (unsigned int)w;
+		target.pitch = outStride;
+		target.buffer = output;
+		target.pixel_mode = FT_PIXEL_MODE_GRAY;
+		target.num_grays = 256;
+		FT_Outline_Translate(&ftGlyph->outline, -ftGlyph->bitmap_left * 64, (h - ftGlyph->bitmap_top) * 64);
+		FT_Outline_Get_Bitmap(ftGlyph->library, &ftGlyph->outline, &target);
+		return;
+	}
+#endif
+
+	// Embedded bitmaps, or FreeType rendered into the glyph slot.
+	if (src == NULL) return;
+	if (w > outWidth) w = outWidth;
+	if (h > outHeight) h = outHeight;
+	// Rows go bottom up when the pitch is negative.
+	if (bitmap->pitch < 0)
+		src -= bitmap->pitch * ((int)bitmap->rows - 1);
+	for (y = 0; y < h; y++) {
+		memcpy(output + y*outStride, src, w);
+		src += bitmap->pitch;
 	}
 }
 
+static const unsigned char* font__tt_buildGlyphSDF(FONTttFontImpl *font, int glyph, float size, float scale, int padding, int onedge,
+										   int *advance, int *x0, int *y0, int *x1, int *y1, int *stride)
+{
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 11)
+	FT_Error ftError;
+	FT_GlyphSlot ftGlyph;
+	FT_Int spread = padding;
+	FONT_NOTUSED(scale);
+	FONT_NOTUSED(onedge);	// FreeType always puts the edge at 128.
+
+	*advance = 0;
+	*x0 = *y0 = *x1 = *y1 = 0;
+	FT_Property_Set(ftLibrary, "sdf", "spread", &spread);
+	if (font__tt_setSize(font, size) == 0) return NULL;
+	ftError = FT_Load_Glyph(font->font, glyph, FT_LOAD_DEFAULT | FT_LOAD_LINEAR_DESIGN);
+	if (ftError) return NULL;
+	ftGlyph = font->font->glyph;
+	*advance = (int)ftGlyph->linearHoriAdvance;
+	ftError = FT_Render_Glyph(ftGlyph, FT_RENDER_MODE_SDF);
+	if (ftError || ftGlyph->bitmap.buffer == NULL || ftGlyph->bitmap.pitch < 0) return NULL;
+	*x0 = ftGlyph->bitmap_left;
+	*x1 = *x0 + ftGlyph->bitmap.width;
+	*y0 = -ftGlyph->bitmap_top;
+	*y1 = *y0 + ftGlyph->bitmap.rows;
+	*stride = ftGlyph->bitmap.pitch;
+	return ftGlyph->bitmap.buffer;
+#else
+	// Distance field rendering needs FreeType 2.11 or later.
+	FONT_NOTUSED(font);
+	FONT_NOTUSED(glyph);
+	FONT_NOTUSED(size);
+	FONT_NOTUSED(scale);
+	FONT_NOTUSED(padding);
+	FONT_NOTUSED(onedge);
+	FONT_NOTUSED(stride);
+	*advance = 0;
+	*x0 = *y0 = *x1 = *y1 = 0;
+	return NULL;
+#endif
+}
+
+static int font__tt_hasKerning(FONTttFontImpl *font)
+{
+	return FT_HAS_KERNING(font->font) ? 1 : 0;
+}
+
+// Returns the kerning in font units like stb_truetype, so that it does not depend on the active size
+// and can be cached per face.
 static int font__tt_getGlyphKernAdvance(FONTttFontImpl *font, int glyph1, int glyph2)
 {
 	FT_Vector ftKerning;
-	FT_Get_Kerning(font->font, glyph1, glyph2, FT_KERNING_DEFAULT, &ftKerning);
-	return (int)((ftKerning.x + 32) >> 6);  // Round up and convert to integer
+	if (FT_Get_Kerning(font->font, glyph1, glyph2, FT_KERNING_UNSCALED, &ftKerning))
+		return 0;
+	return (int)ftKerning.x;
 }
 
 #else
@@ -260,12 +624,71 @@ static int font__tt_getGlyphKernAdvance(FONTttFontImpl *font, int glyph1, int gl
 #define STBTT_STATIC
 static void* font__tmpalloc(size_t size, void* up);
 static void font__tmpfree(void* ptr, void* up);
+static void* font__tmprealloc(void* ptr, size_t oldsize, size_t size, void* up);
+static size_t font__tmpreallocMax(void* ptr, size_t oldsize, void* up);
 #define STBTT_malloc(x,u)    font__tmpalloc(x,u)
 #define STBTT_free(x,u)      font__tmpfree(x,u)
+#define STBTT_realloc(p,o,n,u) font__tmprealloc(p,o,n,u)
+#define STBTT_realloc_max(p,o,u) font__tmpreallocMax(p,o,u)
+#if defined(FONT_SIMD_SSE2) || defined(FONT_SIMD_NEON)
+static void font__accumulateScanline(unsigned char* dst, const float* scanline, const float* scanline2, int w);
+#define STBTT_accumulate_scanline(d,a,b,w) font__accumulateScanline(d,a,b,w)
+#endif
 #include "stb_truetype.h"
 
+// Pair adjustment subtable of the GPOS table, flattened into arrays indexed by glyph.
+struct FONTpairPos {
+	int format;				// 1: glyph pairs, 2: class pairs, 0: unsupported value format.
+	int first, count;		// Range of the first glyphs covered by the subtable.
+	short* cover;			// Coverage index (format 1) or class (format 2) of the first glyph, -1 if none.
+	int* pairStart;			// Format 1: start of the pairs of each coverage index, ncover+1 entries.
+	unsigned short* pairGlyph;
+	short* pairValue;
+	int first2, count2;		// Format 2: range of the second glyphs in the class definition.
+	short* class2;			// Format 2: class of the second glyph, -1 if none.
+	int nclass2;
+	short* values;			// Format 2: class pair matrix.
+};
+typedef struct FONTpairPos FONTpairPos;
+
+// Decoded outlines are kept so that new sizes of a glyph skip parsing the glyph data.
+#ifndef FONT_OUTLINE_CACHE_SIZE
+#	define FONT_OUTLINE_CACHE_SIZE (256*1024)	// Bytes per font.
+#endif
+#define FONT_OUTLINE_LUT_SIZE 64
+
+// Max distance of the flattened curves from the outline, in pixels. Above FONT_FLATNESS_SIZE
+// pixels the distance shrinks with the size, so that the long curves of big glyphs do not show facets.
+#ifndef FONT_FLATNESS
+#	define FONT_FLATNESS 0.35f
+#endif
+#ifndef FONT_FLATNESS_SIZE
+#	define FONT_FLATNESS_SIZE 32.0f
+#endif
+#define FONT_MAX_CURVE_SEGMENTS 256
+
+struct FONToutline {
+	int glyph;
+	int nverts;
+	int size;					// Bytes used by the outline.
+	int hasBox;
+	int x0, y0, x1, y1;			// Glyph box in font units.
+	stbtt_vertex* verts;
+	struct FONToutline* prev;	// Least recently used list, most recent first.
+	struct FONToutline* next;
+	struct FONToutline* hnext;
+};
+typedef struct FONToutline FONToutline;
+
 struct FONTttFontImpl {
 	stbtt_fontinfo font;
+	FONTpairPos* pairPos;
+	int npairPos;
+	int flatKerning;
+	FONToutline* outlineLut[FONT_OUTLINE_LUT_SIZE];
+	FONToutline* mru;
+	FONToutline* lru;
+	int outlineBytes;
 };
 typedef struct FONTttFontImpl FONTttFontImpl;
 
@@ -275,6 +698,273 @@ static int font__tt_init(FONTcontext *context)
 	return 1;
 }
 
+// Returns the range of glyphs in a coverage table, and the number of coverage indices.
+static int font__tt_coverageRange(stbtt_uint8* table, int* first, int* last)
+{
+	int i, n, count = 0;
+	*first = 0xffff;
+	*last = -1;
+	switch (ttUSHORT(table)) {
+		case 1:
+			n = ttUSHORT(table + 2);
+			for (i = 0; i < n; i++) {
+				int g = ttUSHORT(table + 4 + 2*i);
+				if (g < *first) *first = g;
+				if (g > *last) *last = g;
+			}
+			count = n;
+			break;
+		case 2:
+			n = ttUSHORT(table + 2);
+			for (i = 0; i < n; i++) {
+				stbtt_uint8* range = table + 4 + 6*i;
+				int start = ttUSHORT(range), end = ttUSHORT(range + 2), index = ttUSHORT(range + 4);
+				if (end < start) continue;
+				if (start < *first) *first = start;
+				if (end > *last) *last = end;
+				if (index + end - start + 1 > count) count = index + end - start + 1;
+			}
+			break;
+	}
+	return count;
+}
+
+static void font__tt_fillCoverage(stbtt_uint8* table, short* cover, int first)
+{
+	int i, g, n = ttUSHORT(table + 2);
+	if (ttUSHORT(table) == 1) {
+		for (i = 0; i < n; i++)
+			cover[ttUSHORT(table + 4 + 2*i) - first] = (short)i;
+	} else {
+		for (i = 0; i < n; i++) {
+			stbtt_uint8* range = table + 4 + 6*i;
+			int start = ttUSHORT(range), end = ttUSHORT(range + 2), index = ttUSHORT(range + 4);
+			for (g = start; g <= end; g++)
+				cover[g - first] = (short)(index + g - start);
+		}
+	}
+}
+
+// Returns the class definition as an array over [first, first+count), glyphs not in the table are -1.
+static short* font__tt_flattenClassDef(stbtt_uint8* table, int* first, int* count)
+{
+	short* classes = NULL;
+	int i, g, n, lo = 0xffff, hi = -1;
+	int format = ttUSHORT(table);
+
+	*first = 0;
+	*count = 0;
+	if (format == 1) {
+		n = ttUSHORT(table + 4);
+		if (n == 0) return NULL;
+		lo = ttUSHORT(table + 2);
+		hi = lo + n - 1;
+	} else if (format == 2) {
+		n = ttUSHORT(table + 2);
+		for (i = 0; i < n; i++) {
+			int start = ttUSHORT(table + 4 + 6*i), end = ttUSHORT(table + 4 + 6*i + 2);
+			if (end < start) continue;
+			if (start < lo) lo = start;
+			if (end > hi) hi = end;
+		}
+	}
+	if (hi < lo) return NULL;
+
+	classes = (short*)malloc(sizeof(short) * (hi - lo + 1));
+	if (classes == NULL) return NULL;
+	for (i = 0; i < hi - lo + 1; i++)
+		classes[i] = -1;
+	if (format == 1) {
+		for (i = 0; i < n; i++)
+			classes[i] = (short)ttUSHORT(table + 6 + 2*i);
+	} else {
+		for (i = 0; i < n; i++) {
+			stbtt_uint8* range = table + 4 + 6*i;
+			int start = ttUSHORT(range), end = ttUSHORT(range + 2), cls = ttUSHORT(range + 4);
+			for (g = start; g <= end; g++)
+				classes[g - lo] = (short)cls;
+		}
+	}
+	*first = lo;
+	*count = hi - lo + 1;
+	return classes;
+}
+
+static void font__tt_freePairPos(FONTttFontImpl *font)
+{
+	int i;
+	for (i = 0; i < font->npairPos; i++) {
+		FONTpairPos* sub = &font->pairPos[i];
+		free(sub->cover);
+		free(sub->pairStart);
+		free(sub->pairGlyph);
+		free(sub->pairValue);
+		free(sub->class2);
+		free(sub->values);
+	}
+	free(font->pairPos);
+	font->pairPos = NULL;
+	font->npairPos = 0;
+	font->flatKerning = 0;
+}
+
+static int font__tt_flattenPairPos(FONTpairPos* sub, stbtt_uint8* table)
+{
+	int i, j, last, ncover;
+	int posFormat = ttUSHORT(table);
+	int valueFormat1 = ttUSHORT(table + 4);
+	int valueFormat2 = ttUSHORT(table + 6);
+	stbtt_uint8* coverage = table + ttUSHORT(table + 2);
+
+	ncover = font__tt_coverageRange(coverage, &sub->first, &last);
+	if (last < sub->first) return 1;
+	sub->count = last - sub->first + 1;
+	sub->cover = (short*)malloc(sizeof(short) * sub->count);
+	if (sub->cover == NULL) return 0;
+	for (i = 0; i < sub->count; i++)
+		sub->cover[i] = -1;
+	font__tt_fillCoverage(coverage, sub->cover, sub->first);
+
+	// Only x advance adjustment of the first glyph is supported, like stbtt_GetGlyphKernAdvance().
+	if (valueFormat1 != 4 || valueFormat2 != 0) {
+		sub->format = 0;
+		return 1;
+	}
+	sub->format = posFormat;
+
+	if (posFormat == 1) {
+		int pairSetCount = ttUSHORT(table + 8);
+		int npairs = 0;
+		if (ncover > pairSetCount) ncover = pairSetCount;
+		sub->pairStart = (int*)malloc(sizeof(int) * (ncover + 1));
+		if (sub->pairStart == NULL) return 0;
+		for (i = 0; i < ncover; i++) {
+			sub->pairStart[i] = npairs;
+			npairs += ttUSHORT(table + ttUSHORT(table + 10 + 2*i));
+		}
+		sub->pairStart[ncover] = npairs;
+		for (i = 0; i < sub->count; i++)
+			if (sub->cover[i] >= ncover) sub->cover[i] = -1;
+		if (npairs > 0) {
+			sub->pairGlyph = (unsigned short*)malloc(sizeof(unsigned short) * npairs);
+			sub->pairValue = (short*)malloc(sizeof(short) * npairs);
+			if (sub->pairGlyph == NULL || sub->pairValue == NULL) return 0;
+		}
+		for (i = 0; i < ncover; i++) {
+			stbtt_uint8* pairSet = table + ttUSHORT(table + 10 + 2*i);
+			int n = sub->pairStart[i+1] - sub->pairStart[i];
+			for (j = 0; j < n; j++) {
+				sub->pairGlyph[sub->pairStart[i] + j] = ttUSHORT(pairSet + 2 + 4*j);
+				sub->pairValue[sub->pairStart[i] + j] = ttSHORT(pairSet + 2 + 4*j + 2);
+			}
+		}
+	} else if (posFormat == 2) {
+		int first1, count1;
+		int nclass1 = ttUSHORT(table + 12);
+		short* class1 = font__tt_flattenClassDef(table + ttUSHORT(table + 8), &first1, &count1);
+		sub->nclass2 = ttUSHORT(table + 14);
+
+		// Store the first glyph class in place of the coverage index.
+		for (i = 0; i < sub->count; i++) {
+			int g = sub->first + i, c = -1;
+			if (sub->cover[i] < 0) continue;
+			if (g >= first1 && g < first1 + count1)
+				c = class1[g - first1];
+			sub->cover[i] = (short)(c < nclass1 ? c : -1);
+		}
+		free(class1);
+
+		sub->class2 = font__tt_flattenClassDef(table + ttUSHORT(table + 10), &sub->first2, &sub->count2);
+		for (i = 0; i < sub->count2; i++)
+			if (sub->class2[i] >= sub->nclass2) sub->class2[i] = -1;
+
+		if (nclass1 > 0 && sub->nclass2 > 0) {
+			sub->values = (short*)malloc(sizeof(short) * nclass1 * sub->nclass2);
+			if (sub->values == NULL) return 0;
+			for (i = 0; i < nclass1 * sub->nclass2; i++)
+				sub->values[i] = ttSHORT(table + 16 + 2*i);
+		}
+	} else {
+		// Unknown format, never matches.
+		sub->count = 0;
+	}
+	return 1;
+}
+
+// Flattens the pair adjustment lookups of the GPOS table so that kerning does not need to parse the table.
+static int font__tt_flattenKerning(FONTttFontImpl *font)
+{
+	stbtt_uint8 *data, *lookupList;
+	int i, j, n, lookupCount;
+
+	font->flatKerning = 1;
+	if (!font->font.gpos) return 1;
+	data = font->font.data + font->font.gpos;
+	if (ttUSHORT(data+0) != 1 || ttUSHORT(data+2) != 0) return 1;
+
+	lookupList = data + ttUSHORT(data+8);
+	lookupCount = ttUSHORT(lookupList);
+
+	n = 0;
+	for (i = 0; i < lookupCount; i++) {
+		stbtt_uint8* lookup = lookupList + ttUSHORT(lookupList + 2 + 2*i);
+		if (ttUSHORT(lookup) == 2)
+			n += ttUSHORT(lookup + 4);
+	}
+	if (n == 0) return 1;
+
+	font->pairPos = (FONTpairPos*)malloc(sizeof(FONTpairPos) * n);
+	if (font->pairPos == NULL) goto error;
+	memset(font->pairPos, 0, sizeof(FONTpairPos) * n);
+
+	for (i = 0; i < lookupCount; i++) {
+		stbtt_uint8* lookup = lookupList + ttUSHORT(lookupList + 2 + 2*i);
+		int subTableCount = ttUSHORT(lookup + 4);
+		if (ttUSHORT(lookup) != 2) continue;
+		for (j = 0; j < subTableCount; j++) {
+			FONTpairPos* sub = &font->pairPos[font->npairPos++];
+			if (!font__tt_flattenPairPos(sub, lookup + ttUSHORT(lookup + 6 + 2*j)))
+				goto error;
+		}
+	}
+	return 1;
+
+error:
+	// Fall back to reading the font tables.
+	font__tt_freePairPos(font);
+	return 0;
+}
+
+static int font__tt_getFlatKernAdvance(FONTttFontImpl *font, int glyph1, int glyph2)
+{
+	int i, c;
+	for (i = 0; i < font->npairPos; i++) {
+		FONTpairPos* sub = &font->pairPos[i];
+		if (glyph1 < sub->first || glyph1 >= sub->first + sub->count) continue;
+		c = sub->cover[glyph1 - sub->first];
+		if (c < 0) continue;
+		if (sub->format == 0) return 0;
+		if (sub->format == 1) {
+			// Binary search.
+			int l = sub->pairStart[c], r = sub->pairStart[c+1] - 1;
+			while (l <= r) {
+				int m = (l + r) >> 1;
+				if (glyph2 < sub->pairGlyph[m])
+					r = m - 1;
+				else if (glyph2 > sub->pairGlyph[m])
+					l = m + 1;
+				else
+					return sub->pairValue[m];
+			}
+		} else {
+			if (glyph2 < sub->first2 || glyph2 >= sub->first2 + sub->count2) continue;
+			if (sub->class2[glyph2 - sub->first2] < 0) continue;
+			return sub->values[c * sub->nclass2 + sub->class2[glyph2 - sub->first2]];
+		}
+	}
+	return 0;
+}
+
 static int font__tt_loadFont(FONTcontext *context, FONTttFontImpl *font, unsigned char *data, int dataSize)
 {
 	int stbError;
@@ -285,6 +975,122 @@ static int font__tt_loadFont(FONTcontext *context, FONTttFontImpl *font, unsigne
 	return stbError;
 }
 
+// Scratch memory comes from the context rasterizing the glyph, shared fonts are used by several contexts.
+static void font__tt_setContext(FONTttFontImpl *font, FONTcontext *context)
+{
+	font->font.userdata = context;
+}
+
+static void font__tt_unlinkOutline(FONTttFontImpl *font, FONToutline* o)
+{
+	if (o->prev != NULL) o->prev->next = o->next;
+	else font->mru = o->next;
+	if (o->next != NULL) o->next->prev = o->prev;
+	else font->lru = o->prev;
+	o->prev = o->next = NULL;
+}
+
+static void font__tt_pushOutline(FONTttFontImpl *font, FONToutline* o)
+{
+	o->prev = NULL;
+	o->next = font->mru;
+	if (font->mru != NULL) font->mru->prev = o;
+	else font->lru = o;
+	font->mru = o;
+}
+
+static void font__tt_freeOutline(FONTttFontImpl *font, FONToutline* o)
+{
+	FONToutline** link = &font->outlineLut[(unsigned int)o->glyph & (FONT_OUTLINE_LUT_SIZE-1)];
+	while (*link != o)
+		link = &(*link)->hnext;
+	*link = o->hnext;
+	font__tt_unlinkOutline(font, o);
+	font->outlineBytes -= o->size;
+	free(o);
+}
+
+static void font__tt_growBox(FONToutline* o, int x, int y)
+{
+	if (x < o->x0) o->x0 = x;
+	if (y < o->y0) o->y0 = y;
+	if (x > o->x1) o->x1 = x;
+	if (y > o->y1) o->y1 = y;
+}
+
+// Returns the decoded outline of the glyph, or NULL if out of memory.
+static FONToutline* font__tt_getOutline(FONTttFontImpl *font, int glyph)
+{
+	unsigned int h = (unsigned int)glyph & (FONT_OUTLINE_LUT_SIZE-1);
+	stbtt_vertex* verts = NULL;
+	FONToutline* o;
+	int nverts, size;
+
+	for (o = font->outlineLut[h]; o != NULL; o = o->hnext) {
+		if (o->glyph == glyph) {
+			if (o != font->mru) {
+				font__tt_unlinkOutline(font, o);
+				font__tt_pushOutline(font, o);
+			}
+			return o;
+		}
+	}
+
+	nverts = stbtt_GetGlyphShape(&font->font, glyph, &verts);
+	size = (int)(sizeof(FONToutline) + sizeof(stbtt_vertex) * nverts);
+	o = (FONToutline*)malloc(size);
+	if (o == NULL) {
+		STBTT_free(verts, font->font.userdata);
+		return NULL;
+	}
+	memset(o, 0, sizeof(FONToutline));
+	o->glyph = glyph;
+	o->nverts = nverts;
+	o->size = size;
+	o->verts = (stbtt_vertex*)(o + 1);
+	if (nverts > 0)
+		memcpy(o->verts, verts, sizeof(stbtt_vertex) * nverts);
+	STBTT_free(verts, font->font.userdata);
+	if (font->font.cff.size == 0) {
+		o->hasBox = stbtt_GetGlyphBox(&font->font, glyph, &o->x0, &o->y0, &o->x1, &o->y1);
+	} else {
+		// The CFF box is the extent of all points, including the control points,
+		// so take it from the outline instead of running the charstring again.
+		int i;
+		o->hasBox = 1;
+		if (nverts > 0) {
+			o->x0 = o->x1 = o->verts[0].x;
+			o->y0 = o->y1 = o->verts[0].y;
+		}
+		for (i = 0; i < nverts; i++) {
+			stbtt_vertex* v = &o->verts[i];
+			font__tt_growBox(o, v->x, v->y);
+			if (v->type == STBTT_vcubic) {
+				font__tt_growBox(o, v->cx, v->cy);
+				font__tt_growBox(o, v->cx1, v->cy1);
+			}
+		}
+	}
+
+	o->hnext = font->outlineLut[h];
+	font->outlineLut[h] = o;
+	font__tt_pushOutline(font, o);
+	font->outlineBytes += size;
+
+	// Keep within the budget, the new outline is kept even if it alone is over it.
+	while (font->outlineBytes > FONT_OUTLINE_CACHE_SIZE && font->lru != o)
+		font__tt_freeOutline(font, font->lru);
+
+	return o;
+}
+
+static void font__tt_freeFont(FONTttFontImpl *font)
+{
+	font__tt_freePairPos(font);
+	while (font->mru != NULL)
+		font__tt_freeOutline(font, font->mru);
+}
+
 static void font__tt_getFontVMetrics(FONTttFontImpl *font, int *ascent, int *descent, int *lineGap)
 {
 	stbtt_GetFontVMetrics(&font->font, ascent, descent, lineGap);
@@ -300,54 +1106,280 @@ static int font__tt_getGlyphIndex(FONTttFontImpl *font, int codepoint)
 	return stbtt_FindGlyphIndex(&font->font, codepoint);
 }
 
+// Lists the mapped code points above the BMP, returns 0 on failure.
+static int font__tt_getCmapRanges(FONTttFontImpl *font, FONTcmapRange** ranges, int* nranges)
+{
+	stbtt_uint8* data = font->font.data + font->font.index_map;
+	int i, ngroups, format = ttUSHORT(data);
+	*ranges = NULL;
+	*nranges = 0;
+	// Only the segmented coverage formats go above the BMP.
+	if (format != 12 && format != 13) return 1;
+	ngroups = (int)ttULONG(data + 12);
+	if (ngroups <= 0) return 1;
+	*ranges = (FONTcmapRange*)malloc(sizeof(FONTcmapRange) * ngroups);
+	if (*ranges == NULL) return 0;
+	for (i = 0; i < ngroups; i++) {
+		stbtt_uint8* group = data + 16 + i*12;
+		FONTcmapRange* range = &(*ranges)[*nranges];
+		range->first = ttULONG(group);
+		range->last = ttULONG(group + 4);
+		range->glyph = (int)ttULONG(group + 8);
+		range->constant = format == 13;
+		if (range->last < 0x10000) continue;
+		if (range->first < 0x10000) {
+			if (!range->constant) range->glyph += 0x10000 - range->first;
+			range->first = 0x10000;
+		}
+		(*nranges)++;
+	}
+	return 1;
+}
+
 static int font__tt_buildGlyphBitmap(FONTttFontImpl *font, int glyph, float size, float scale,
 							  int *advance, int *lsb, int *x0, int *y0, int *x1, int *y1)
 {
+	FONToutline* o;
 	FONT_NOTUSED(size);
 	stbtt_GetGlyphHMetrics(&font->font, glyph, advance, lsb);
-	stbtt_GetGlyphBitmapBox(&font->font, glyph, scale, scale, x0, y0, x1, y1);
+	o = font__tt_getOutline(font, glyph);
+	if (o == NULL) {
+		stbtt_GetGlyphBitmapBox(&font->font, glyph, scale, scale, x0, y0, x1, y1);
+	} else if (!o->hasBox) {
+		*x0 = *y0 = *x1 = *y1 = 0;
+	} else {
+		// Same rounding as stbtt_GetGlyphBitmapBox().
+		*x0 = STBTT_ifloor(o->x0 * scale);
+		*y0 = STBTT_ifloor(-o->y1 * scale);
+		*x1 = STBTT_iceil(o->x1 * scale);
+		*y1 = STBTT_iceil(-o->y0 * scale);
+	}
 	return 1;
 }
 
-static void font__tt_renderGlyphBitmap(FONTttFontImpl *font, unsigned char *output, int outWidth, int outHeight, int outStride,
-								float scaleX, float scaleY, int glyph)
+// Returns the number of segments needed to keep a curve within tol of its chord, given the
+// squared length of its largest second difference, scaled by the curve degree.
+static int font__tt_curveSegments(float dd, float tol)
 {
-	stbtt_MakeGlyphBitmap(&font->font, output, outWidth, outHeight, outStride, scaleX, scaleY, glyph);
+	float n = sqrtf(sqrtf(dd) / tol);
+	if (n <= 1.0f) return 1;
+	if (n >= FONT_MAX_CURVE_SEGMENTS) return FONT_MAX_CURVE_SEGMENTS;
+	return (int)ceilf(n);
 }
 
-static int font__tt_getGlyphKernAdvance(FONTttFontImpl *font, int glyph1, int glyph2)
+// Returns the flatness in font units for rendering at the given scale.
+static float font__tt_flatness(FONTttFontImpl *font, float scale)
 {
-	return stbtt_GetGlyphKernAdvance(&font->font, glyph1, glyph2);
+	// Inverse of stbtt_ScaleForPixelHeight().
+	int height = ttSHORT(font->font.data + font->font.hhea + 4) - ttSHORT(font->font.data + font->font.hhea + 6);
+	float size = scale * height;
+	float flatness = FONT_FLATNESS;
+	if (size > FONT_FLATNESS_SIZE)
+		flatness *= FONT_FLATNESS_SIZE / size;
+	return flatness / scale;
 }
 
-#endif
+// Flattens the outline into polygons in one pass. Each quadratic curve is split into a number of
+// segments computed from how far its control point deviates from the chord, and the points
+// are generated with forward differences instead of recursive subdivision. Cubics use the
+// subdivision of stbtt_FlattenCurves() so that CFF glyphs rasterize the same as with stb_truetype.
+static stbtt__point* font__tt_flattenOutline(FONToutline* o, float flatness, int** lengths, int* ncontours, void* userdata)
+{
+	stbtt__point* pts = NULL;
+	int i, j, n = 0, npts = 0, cpts = 0, start = 0;
+	float x = 0, y = 0;
+
+	*lengths = NULL;
+	*ncontours = 0;
+	for (i = 0; i < o->nverts; i++)
+		if (o->verts[i].type == STBTT_vmove)
+			n++;
+	if (n == 0 || o->verts[0].type != STBTT_vmove) return NULL;
+	*lengths = (int*)STBTT_malloc(sizeof(int) * n, userdata);
+	if (*lengths == NULL) return NULL;
+
+	n = -1;
+	for (i = 0; i < o->nverts; i++) {
+		stbtt_vertex* v = &o->verts[i];
+		float ax, ay, bx, by, h;
+		int nseg = 1;
+
+		// A curve deviates from its chord by at most |P0 - 2*P1 + P2| / (4*n^2) when split into n even steps.
+		if (v->type == STBTT_vcurve) {
+			ax = x - 2*v->cx + v->x;
+			ay = y - 2*v->cy + v->y;
+			nseg = font__tt_curveSegments(ax*ax + ay*ay, 4*flatness);
+		} else if (v->type == STBTT_vcubic) {
+			nseg = 0;
+			stbtt__tesselate_cubic(NULL, &nseg, x,y, v->cx,v->cy, v->cx1,v->cy1, v->x,v->y, flatness*flatness, 0);
+		}
 
-#ifndef FONT_SCRATCH_BUF_SIZE
-#	define FONT_SCRATCH_BUF_SIZE 64000
-#endif
-#ifndef FONT_HASH_LUT_SIZE
-#	define FONT_HASH_LUT_SIZE 256
-#endif
-#ifndef FONT_INIT_FONTS
-#	define FONT_INIT_FONTS 4
-#endif
-#ifndef FONT_INIT_GLYPHS
-#	define FONT_INIT_GLYPHS 256
-#endif
-#ifndef FONT_INIT_ATLAS_NODES
-#	define FONT_INIT_ATLAS_NODES 256
-#endif
-#ifndef FONT_VERTEX_COUNT
-#	define FONT_VERTEX_COUNT 1024
-#endif
-#ifndef FONT_MAX_STATES
-#	define FONT_MAX_STATES 20
-#endif
-#ifndef FONT_MAX_FALLBACKS
-#	define FONT_MAX_FALLBACKS 20
-#endif
+		if (npts + nseg > cpts) {
+			int cpts2 = cpts == 0 ? 256 : cpts*2;
+			stbtt__point* pts2;
+			while (cpts2 < npts + nseg) cpts2 *= 2;
+			pts2 = (stbtt__point*)STBTT_realloc(pts, sizeof(stbtt__point) * cpts, sizeof(stbtt__point) * cpts2, userdata);
+			if (pts2 == NULL) goto error;
+			pts = pts2;
+			cpts = cpts2;
+		}
 
-static unsigned int font__hashint(unsigned int a)
+		switch (v->type) {
+			case STBTT_vmove:
+				if (n >= 0) (*lengths)[n] = npts - start;
+				n++;
+				start = npts;
+				pts[npts].x = v->x; pts[npts].y = v->y; npts++;
+				break;
+			case STBTT_vline:
+				pts[npts].x = v->x; pts[npts].y = v->y; npts++;
+				break;
+			case STBTT_vcurve:
+				// P(t) = A*t^2 + B*t + P0
+				h = 1.0f / nseg;
+				ax = (x - 2*v->cx + v->x) * h*h;
+				ay = (y - 2*v->cy + v->y) * h*h;
+				bx = ax + 2*(v->cx - x) * h;
+				by = ay + 2*(v->cy - y) * h;
+				for (j = 1; j < nseg; j++) {
+					x += bx; y += by;
+					bx += 2*ax; by += 2*ay;
+					pts[npts].x = x; pts[npts].y = y; npts++;
+				}
+				pts[npts].x = v->x; pts[npts].y = v->y; npts++;
+				break;
+			case STBTT_vcubic:
+				stbtt__tesselate_cubic(pts, &npts, x,y, v->cx,v->cy, v->cx1,v->cy1, v->x,v->y, flatness*flatness, 0);
+				break;
+		}
+		x = v->x;
+		y = v->y;
+	}
+	(*lengths)[n] = npts - start;
+	*ncontours = n + 1;
+	return pts;
+
+error:
+	STBTT_free(pts, userdata);
+	STBTT_free(*lengths, userdata);
+	*lengths = NULL;
+	return NULL;
+}
+
+static void font__tt_renderGlyphBitmap(FONTttFontImpl *font, unsigned char *output, int outWidth, int outHeight, int outStride,
+								float scaleX, float scaleY, int glyph)
+{
+	stbtt__bitmap gbm;
+	stbtt__point* pts;
+	int* lengths;
+	int ncontours, ix0 = 0, iy0 = 0;
+	FONToutline* o = font__tt_getOutline(font, glyph);
+	if (o == NULL) {
+		stbtt_MakeGlyphBitmap(&font->font, output, outWidth, outHeight, outStride, scaleX, scaleY, glyph);
+		return;
+	}
+	if (o->hasBox) {
+		ix0 = STBTT_ifloor(o->x0 * scaleX);
+		iy0 = STBTT_ifloor(-o->y1 * scaleY);
+	}
+	gbm.pixels = output;
+	gbm.w = outWidth;
+	gbm.h = outHeight;
+	gbm.stride = outStride;
+	if (gbm.w == 0 || gbm.h == 0) return;
+
+	pts = font__tt_flattenOutline(o, font__tt_flatness(font, scaleX < scaleY ? scaleX : scaleY), &lengths, &ncontours, font->font.userdata);
+	if (pts != NULL)
+		stbtt__rasterize(&gbm, pts, lengths, ncontours, scaleX, scaleY, 0.0f, 0.0f, ix0, iy0, 1, font->font.userdata);
+	STBTT_free(lengths, font->font.userdata);
+	STBTT_free(pts, font->font.userdata);
+}
+
+// Returns the distance field of the glyph in scratch memory, or NULL if the glyph is empty.
+static const unsigned char* font__tt_buildGlyphSDF(FONTttFontImpl *font, int glyph, float size, float scale, int padding, int onedge,
+										   int *advance, int *x0, int *y0, int *x1, int *y1, int *stride)
+{
+	int lsb, w = 0, h = 0;
+	unsigned char* data;
+	FONT_NOTUSED(size);
+	stbtt_GetGlyphHMetrics(&font->font, glyph, advance, &lsb);
+	*x0 = *y0 = 0;
+	data = stbtt_GetGlyphSDF(&font->font, scale, glyph, padding, (unsigned char)onedge, (float)onedge / (float)padding, &w, &h, x0, y0);
+	if (data == NULL) {
+		*x0 = *y0 = *x1 = *y1 = 0;
+		return NULL;
+	}
+	*x1 = *x0 + w;
+	*y1 = *y0 + h;
+	*stride = w;
+	return data;
+}
+
+static int font__tt_hasKerning(FONTttFontImpl *font)
+{
+	return font->font.kern != 0 || font->font.gpos != 0;
+}
+
+static int font__tt_getGlyphKernAdvance(FONTttFontImpl *font, int glyph1, int glyph2)
+{
+	if (font->flatKerning && font->font.gpos)
+		return font__tt_getFlatKernAdvance(font, glyph1, glyph2);
+	return stbtt_GetGlyphKernAdvance(&font->font, glyph1, glyph2);
+}
+
+#endif
+
+#ifndef FONT_SCRATCH_BUF_SIZE
+#	define FONT_SCRATCH_BUF_SIZE 64000
+#endif
+#ifndef FONT_HASH_LUT_SIZE
+#	define FONT_HASH_LUT_SIZE 256
+#endif
+#ifndef FONT_INIT_FONTS
+#	define FONT_INIT_FONTS 4
+#endif
+#ifndef FONT_INIT_GLYPHS
+#	define FONT_INIT_GLYPHS 256
+#endif
+#ifndef FONT_KERN_CACHE_SIZE
+#	define FONT_KERN_CACHE_SIZE 1024	// Must be power of two.
+#endif
+// Kerning between printable ASCII characters is precomputed in a dense table.
+#define FONT_ASCII_KERN_FIRST 32
+#define FONT_ASCII_KERN_COUNT 96
+#define FONT_ASCII_KERN_NONE (-32768)
+#ifndef FONT_INIT_ATLAS_NODES
+#	define FONT_INIT_ATLAS_NODES 256
+#endif
+#ifndef FONT_VERTEX_COUNT
+#	define FONT_VERTEX_COUNT 1024
+#endif
+#ifndef FONT_MAX_STATES
+#	define FONT_MAX_STATES 20
+#endif
+#ifndef FONT_MAX_FALLBACKS
+#	define FONT_MAX_FALLBACKS 20
+#endif
+// With FONT_LOWRES_BLUR, the resolution is halved while the blur stays above FONT_LOWRES_MIN_BLUR pixels.
+#ifndef FONT_LOWRES_MIN_BLUR
+#	define FONT_LOWRES_MIN_BLUR 4
+#endif
+#ifndef FONT_LOWRES_MAX_LEVEL
+#	define FONT_LOWRES_MAX_LEVEL 2
+#endif
+// With FONT_SDF, glyphs are stored at FONT_SDF_SIZE pixels, with the distance encoded FONT_SDF_PADDING
+// pixels out from the edge, and FONT_SDF_ONEDGE as the value at the edge.
+#ifndef FONT_SDF_SIZE
+#	define FONT_SDF_SIZE 48
+#endif
+#ifndef FONT_SDF_PADDING
+#	define FONT_SDF_PADDING 8
+#endif
+#ifndef FONT_SDF_ONEDGE
+#	define FONT_SDF_ONEDGE 128
+#endif
+
+static unsigned int font__hashint(unsigned int a)
 {
 	a += ~(a<<15);
 	a ^=  (a>>10);
@@ -368,33 +1400,111 @@ static int font__maxi(int a, int b)
 	return a > b ? a : b;
 }
 
+// Glyph bitmap in the atlas, stored in the font it is rendered from.
 struct FONTglyph
 {
-	unsigned int codepoint;
 	int index;
 	int next;
 	short size, blur;
 	short x0,y0,x1,y1;
 	short xadv,xoff,yoff;
+	short shift;	// Low resolution glyphs are stored at 1/(1<<shift) scale.
+	unsigned short advance;	// Advance in font units of the font the glyph was rendered with.
+	struct FONTfont* font;
 };
 typedef struct FONTglyph FONTglyph;
 
-struct FONTfont
+// Maps a code point, size and blur of a font to the glyph bitmap it is drawn with.
+struct FONTglyphRef
+{
+	unsigned int codepoint;
+	short size, blur;
+	struct FONTfont* font;	// Font holding the bitmap, the font itself or a fallback font.
+	int glyph;				// Index of the bitmap in font->glyphs.
+	int next;
+};
+typedef struct FONTglyphRef FONTglyphRef;
+
+// Glyph a code point resolves to in a font and its fallback fonts, glyph 0 if none has it.
+struct FONTcodepoint
+{
+	unsigned int codepoint;
+	int glyph;
+	struct FONTfont* font;
+	int next;
+};
+typedef struct FONTcodepoint FONTcodepoint;
+
+struct FONTkernPair
+{
+	unsigned int key;	// glyph1 << 16 | glyph2, or 0xffffffff for empty slot.
+	int kern;
+};
+typedef struct FONTkernPair FONTkernPair;
+
+// How the font data is released with the font.
+enum FONTdataOwner {
+	FONT_DATA_KEEP = 0,
+	FONT_DATA_FREE = 1,
+	FONT_DATA_UNMAP = 2,
+};
+
+typedef struct FONTface FONTface;
+
+// The font data and the tables parsed from it, shared by the fonts added from the same file or
+// buffer when the contexts use a registry. Freed with the last font using it.
+struct FONTface
 {
 	FONTttFontImpl font;
-	char name[64];
+	char* path;					// NULL for fonts added from memory.
 	unsigned char* data;
 	int dataSize;
-	unsigned char freeData;
+	unsigned char freeData;		// FONTdataOwner
+	int flags;					// The flags of the stash that change the loaded face (FONT_FLATTEN_KERNING).
 	float ascender;
 	float descender;
 	float lineh;
+	int state;								// 0: not loaded yet, 1: loaded, -1: failed to load.
+	const unsigned short* cmapPages[256];	// Glyph indices of the BMP, built a page at a time.
+	FONTcmapRange* cmapRanges;				// Code points above the BMP, sorted.
+	int ncmapRanges;
+	int cmapRangesState;					// 0: not built, 1: built, -1: use the font cmap.
+	int hasKerning;
+	FONTkernPair* kernCache;
+	short* asciiKern;
+	int refs;
+	FONTregistry* registry;
+	FONTface* next;
+};
+
+struct FONTregistry
+{
+	FONTface* faces;
+	int refs;					// The creator and the contexts using the registry.
+};
+
+struct FONTfont
+{
+	FONTface* face;
+	char name[64];
 	FONTglyph* glyphs;
 	int cglyphs;
 	int nglyphs;
 	int lut[FONT_HASH_LUT_SIZE];
+	FONTglyphRef* refs;
+	int crefs;
+	int nrefs;
+	int refLut[FONT_HASH_LUT_SIZE];
+	FONTcodepoint* codepoints;
+	int ccodepoints;
+	int ncodepoints;
+	int codepointLut[FONT_HASH_LUT_SIZE];
 	int fallbacks[FONT_MAX_FALLBACKS];
 	int nfallbacks;
+#ifdef FONT_TT_WORKERS
+	FONTttFontImpl* workerFonts;	// The font opened by each worker, loaded on first use.
+	int nworkerFonts;
+#endif
 };
 typedef struct FONTfont FONTfont;
 
@@ -406,6 +1516,11 @@ struct FONTstate
 	unsigned int color;
 	float blur;
 	float spacing;
+	float outlineWidth;
+	unsigned int outlineColor;
+	float shadowX, shadowY;
+	float shadowSoftness;
+	unsigned int shadowColor;
 };
 typedef struct FONTstate FONTstate;
 
@@ -423,6 +1538,15 @@ struct FONTatlas
 };
 typedef struct FONTatlas FONTatlas;
 
+#ifdef FONT_TT_WORKERS
+struct FONTworker
+{
+	FONTttWorker tt;
+	unsigned char* scratch;
+};
+typedef struct FONTworker FONTworker;
+#endif
+
 struct FONTcontext
 {
 	FONTparams params;
@@ -441,8 +1565,16 @@ struct FONTcontext
 	int nscratch;
 	FONTstate states[FONT_MAX_STATES];
 	int nstates;
+	FONTeffect effect;
+	int sizePolicy;
+	short* sizeBuckets;
+	int nsizeBuckets;
 	void (*handleError)(void* uptr, int error, int val);
 	void* errorUptr;
+#ifdef FONT_TT_WORKERS
+	FONTworker* workers;
+	int nworkers;
+#endif
 };
 
 #ifdef STB_TRUETYPE_IMPLEMENTATION
@@ -472,6 +1604,134 @@ static void font__tmpfree(void* ptr, void* up)
 	// empty
 }
 
+static void* font__tmprealloc(void* ptr, size_t oldsize, size_t size, void* up)
+{
+	unsigned char* ptr2;
+	FONTcontext* stash = (FONTcontext*)up;
+
+	oldsize = (oldsize + 0xf) & ~0xf;
+
+	// Grow in place if this is the last allocation.
+	if (ptr != NULL && (unsigned char*)ptr + oldsize == stash->scratch + stash->nscratch) {
+		stash->nscratch -= (int)oldsize;
+		ptr2 = (unsigned char*)font__tmpalloc(size, up);
+		if (ptr2 == NULL)
+			stash->nscratch += (int)oldsize;
+		return ptr2;
+	}
+
+	// Shrinking keeps the block where it is.
+	if (ptr != NULL && size <= oldsize)
+		return ptr;
+
+	ptr2 = (unsigned char*)font__tmpalloc(size, up);
+	if (ptr2 != NULL && ptr != NULL)
+		memcpy(ptr2, ptr, oldsize);
+	return ptr2;
+}
+
+// Returns the largest size font__tmprealloc() can grow the block to without running out of scratch memory.
+static size_t font__tmpreallocMax(void* ptr, size_t oldsize, void* up)
+{
+	FONTcontext* stash = (FONTcontext*)up;
+	int avail = FONT_SCRATCH_BUF_SIZE - stash->nscratch;
+
+	oldsize = (oldsize + 0xf) & ~0xf;
+	if (ptr != NULL && (unsigned char*)ptr + oldsize == stash->scratch + stash->nscratch)
+		avail += (int)oldsize;
+	return avail > 0 ? (size_t)avail & ~(size_t)0xf : 0;
+}
+
+#if defined(FONT_SIMD_SSE2) || defined(FONT_SIMD_NEON)
+
+// Sums the coverage of a scanline of the stb_truetype rasterizer and converts it to bytes.
+// The running sum is computed a vector at a time, which adds in a different order than the
+// scalar loop, so a pixel can differ from it by 1 when its coverage rounds at half way.
+static void font__accumulateScanline(unsigned char* dst, const float* scanline, const float* scanline2, int w)
+{
+	float sum = 0;
+	int i = 0;
+#if defined(FONT_SIMD_AVX2)
+	{
+		__m256 carry = _mm256_setzero_ps();
+		__m256 sign = _mm256_set1_ps(-0.0f), scale = _mm256_set1_ps(255.0f), half = _mm256_set1_ps(0.5f);
+		for (; i+8 <= w; i += 8) {
+			__m256 x = _mm256_loadu_ps(scanline2 + i), t;
+			__m256i m;
+			__m128i px;
+			// Prefix sum within the 128 bit lanes, then carry the low lane into the high one.
+			x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 4)));
+			x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+			t = _mm256_permute_ps(x, 0xff);
+			x = _mm256_add_ps(x, _mm256_permute2f128_ps(t, t, 0x08));
+			x = _mm256_add_ps(x, carry);
+			t = _mm256_permute_ps(x, 0xff);
+			carry = _mm256_permute2f128_ps(t, t, 0x11);
+			x = _mm256_add_ps(_mm256_loadu_ps(scanline + i), x);
+			x = _mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(sign, x), scale), half);
+			m = _mm256_cvttps_epi32(x);
+			px = _mm_packs_epi32(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+			_mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(px, px));
+		}
+		sum = _mm_cvtss_f32(_mm256_castps256_ps128(carry));
+	}
+#endif
+#if defined(FONT_SIMD_SSE2)
+	{
+		__m128 carry = _mm_set1_ps(sum);
+		__m128 sign = _mm_set1_ps(-0.0f), scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+		for (; i+4 <= w; i += 4) {
+			__m128 x = _mm_loadu_ps(scanline2 + i);
+			__m128i m;
+			int px;
+			x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+			x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+			x = _mm_add_ps(x, carry);
+			carry = _mm_shuffle_ps(x, x, 0xff);
+			x = _mm_add_ps(_mm_loadu_ps(scanline + i), x);
+			x = _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, x), scale), half);
+			m = _mm_cvttps_epi32(x);
+			m = _mm_packs_epi32(m, m);
+			px = _mm_cvtsi128_si32(_mm_packus_epi16(m, m));
+			memcpy(dst + i, &px, 4);
+		}
+		sum = _mm_cvtss_f32(carry);
+	}
+#elif defined(FONT_SIMD_NEON)
+	{
+		float32x4_t carry = vdupq_n_f32(0), zero = vdupq_n_f32(0);
+		float32x4_t scale = vdupq_n_f32(255.0f), half = vdupq_n_f32(0.5f);
+		for (; i+4 <= w; i += 4) {
+			float32x4_t x = vld1q_f32(scanline2 + i);
+			uint16x4_t m;
+			uint32_t px;
+			x = vaddq_f32(x, vextq_f32(zero, x, 3));
+			x = vaddq_f32(x, vextq_f32(zero, x, 2));
+			x = vaddq_f32(x, carry);
+			carry = vdupq_n_f32(vgetq_lane_f32(x, 3));
+			x = vaddq_f32(vld1q_f32(scanline + i), x);
+			x = vaddq_f32(vmulq_f32(vabsq_f32(x), scale), half);
+			m = vqmovun_s32(vcvtq_s32_f32(x));
+			px = vget_lane_u32(vreinterpret_u32_u8(vqmovn_u16(vcombine_u16(m, m))), 0);
+			memcpy(dst + i, &px, 4);
+		}
+		sum = vgetq_lane_f32(carry, 0);
+	}
+#endif
+	for (; i < w; i++) {
+		float k;
+		int m;
+		sum += scanline2[i];
+		k = scanline[i] + sum;
+		k = (float)fabs(k)*255 + 0.5f;
+		m = (int)k;
+		if (m > 255) m = 255;
+		dst[i] = (unsigned char)m;
+	}
+}
+
+#endif
+
 #endif // STB_TRUETYPE_IMPLEMENTATION
 
 // Copyright (c) 2008-2010 Bjoern Hoehrmann <bjoern@hoehrmann.de>
@@ -513,6 +1773,106 @@ static unsigned int font__decutf8(unsigned int* state, unsigned int* codep, unsi
 	return *state;
 }
 
+// Returns the number of ASCII bytes at the start of the string.
+static int font__asciiRun(const char* str, const char* end)
+{
+	const char* s = str;
+#if defined(FONT_SIMD_AVX2)
+	while (end - s >= 32) {
+		if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)s)) != 0) break;
+		s += 32;
+	}
+#endif
+#if defined(FONT_SIMD_SSE2)
+	while (end - s >= 16) {
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)s)) != 0) break;
+		s += 16;
+	}
+#elif defined(FONT_SIMD_NEON)
+	while (end - s >= 16) {
+		uint64x2_t high = vreinterpretq_u64_u8(vandq_u8(vld1q_u8((const uint8_t*)s), vdupq_n_u8(0x80)));
+		if ((vgetq_lane_u64(high, 0) | vgetq_lane_u64(high, 1)) != 0) break;
+		s += 16;
+	}
+#endif
+	while (s != end && *(const unsigned char*)s < 0x80)
+		s++;
+	return (int)(s - str);
+}
+
+// Like font__decutf8(), but bytes of an ASCII run are passed through without the state machine.
+// The run length is kept in ascii, and is only measured between complete code points, so invalid
+// input is handled exactly as by font__decutf8().
+static unsigned int font__decutf8Run(unsigned int* state, unsigned int* codep, int* ascii, const char* str, const char* end)
+{
+	if (*ascii == 0 && *state == FONT_UTF8_ACCEPT)
+		*ascii = font__asciiRun(str, end);
+	if (*ascii > 0) {
+		(*ascii)--;
+		*codep = *(const unsigned char*)str;
+		return FONT_UTF8_ACCEPT;
+	}
+	return font__decutf8(state, codep, *(const unsigned char*)str);
+}
+
+enum FONTencoding {
+	FONT_ENCODING_UTF8,
+	FONT_ENCODING_UTF16,
+	FONT_ENCODING_UTF32,
+	FONT_ENCODING_GLYPHS,	// Array of FONTglyphPos.
+};
+
+// Decodes the next code point and moves str past it, returns 0 if the string ends first.
+static int font__nextCodepoint(int encoding, const char** str, const char* end,
+							   unsigned int* utf8state, int* ascii, unsigned int* codepoint)
+{
+	const char* s = *str;
+	if (encoding == FONT_ENCODING_UTF16) {
+		const unsigned short* p = (const unsigned short*)s;
+		const unsigned short* e = (const unsigned short*)end;
+		unsigned int c;
+		if (p == e) return 0;
+		c = *p++;
+		if (c >= 0xd800 && c < 0xdc00 && p != e && *p >= 0xdc00 && *p < 0xe000)
+			c = 0x10000 + ((c - 0xd800) << 10) + (*p++ - 0xdc00);
+		else if (c >= 0xd800 && c < 0xe000)
+			c = 0xfffd;
+		*codepoint = c;
+		*str = (const char*)p;
+		return 1;
+	}
+	if (encoding == FONT_ENCODING_UTF32) {
+		unsigned int c;
+		if (s == end) return 0;
+		c = *(const unsigned int*)s;
+		if (c > 0x10ffff || (c >= 0xd800 && c < 0xe000))
+			c = 0xfffd;
+		*codepoint = c;
+		*str = s + sizeof(unsigned int);
+		return 1;
+	}
+	for (; s != end; s++) {
+		if (font__decutf8Run(utf8state, codepoint, ascii, s, end))
+			continue;
+		*str = s + 1;
+		return 1;
+	}
+	*str = s;
+	return 0;
+}
+
+static const unsigned short* font__strend16(const unsigned short* str)
+{
+	while (*str) str++;
+	return str;
+}
+
+static const unsigned int* font__strend32(const unsigned int* str)
+{
+	while (*str) str++;
+	return str;
+}
+
 // Atlas based on Skyline Bin Packer by Jukka Jylänki
 
 static void font__deleteAtlas(FONTatlas* atlas)
@@ -726,6 +2086,8 @@ FONTcontext* fontCreateInternal(FONTparams* params)
 	memset(stash, 0, sizeof(FONTcontext));
 
 	stash->params = *params;
+	if (stash->params.registry != NULL)
+		stash->params.registry->refs++;
 
 	// Allocate scratch buffer.
 	stash->scratch = (unsigned char*)malloc(FONT_SCRATCH_BUF_SIZE);
@@ -781,9 +2143,17 @@ static FONTstate* font__getState(FONTcontext* stash)
 
 int fontAddFallbackFont(FONTcontext* stash, int base, int fallback)
 {
+	int i;
 	FONTfont* baseFont = stash->fonts[base];
 	if (baseFont->nfallbacks < FONT_MAX_FALLBACKS) {
 		baseFont->fallbacks[baseFont->nfallbacks++] = fallback;
+		// Code points missing so far may be found in the new fallback font.
+		baseFont->nrefs = 0;
+		baseFont->ncodepoints = 0;
+		for (i = 0; i < FONT_HASH_LUT_SIZE; i++) {
+			baseFont->refLut[i] = -1;
+			baseFont->codepointLut[i] = -1;
+		}
 		return 1;
 	}
 	return 0;
@@ -819,6 +2189,22 @@ void fontSetFont(FONTcontext* stash, int font)
 	font__getState(stash)->font = font;
 }
 
+void fontSetOutline(FONTcontext* stash, float width, unsigned int color)
+{
+	FONTstate* state = font__getState(stash);
+	state->outlineWidth = width;
+	state->outlineColor = color;
+}
+
+void fontSetShadow(FONTcontext* stash, float dx, float dy, float softness, unsigned int color)
+{
+	FONTstate* state = font__getState(stash);
+	state->shadowX = dx;
+	state->shadowY = dy;
+	state->shadowSoftness = softness;
+	state->shadowColor = color;
+}
+
 void fontPushState(FONTcontext* stash)
 {
 	if (stash->nstates >= FONT_MAX_STATES) {
@@ -850,16 +2236,164 @@ void fontClearState(FONTcontext* stash)
 	state->blur = 0;
 	state->spacing = 0;
 	state->align = FONT_ALIGN_LEFT | FONT_ALIGN_BASELINE;
+	state->outlineWidth = 0;
+	state->outlineColor = 0;
+	state->shadowX = state->shadowY = 0;
+	state->shadowSoftness = 0;
+	state->shadowColor = 0;
+}
+
+static const unsigned short font__emptyCmapPage[256] = {0};
+
+static void font__freeData(unsigned char* data, int dataSize, int owner)
+{
+	FONT_NOTUSED(dataSize);
+	if (data == NULL) return;
+	if (owner == FONT_DATA_FREE)
+		free(data);
+#ifdef FONT_MMAP
+	else if (owner == FONT_DATA_UNMAP)
+		munmap(data, (size_t)dataSize);
+#endif
+}
+
+static void font__freeFace(FONTface* face)
+{
+	int i;
+	FONTface** link;
+	if (face == NULL) return;
+	if (face->registry != NULL) {
+		for (link = &face->registry->faces; *link != face; link = &(*link)->next)
+			;
+		*link = face->next;
+	}
+	if (face->cmapRanges) free(face->cmapRanges);
+	for (i = 0; i < 256; i++) {
+		if (face->cmapPages[i] != NULL && face->cmapPages[i] != font__emptyCmapPage)
+			free((void*)face->cmapPages[i]);
+	}
+	if (face->kernCache) free(face->kernCache);
+	if (face->asciiKern) free(face->asciiKern);
+	font__tt_freeFont(&face->font);
+	font__freeData(face->data, face->dataSize, face->freeData);
+	if (face->path) free(face->path);
+	free(face);
+}
+
+static void font__releaseFace(FONTface* face)
+{
+	if (face != NULL && --face->refs == 0)
+		font__freeFace(face);
 }
 
 static void font__freeFont(FONTfont* font)
 {
 	if (font == NULL) return;
 	if (font->glyphs) free(font->glyphs);
-	if (font->freeData && font->data) free(font->data);
+	if (font->refs) free(font->refs);
+	if (font->codepoints) free(font->codepoints);
+#ifdef FONT_TT_WORKERS
+	// Worker fonts are opened over the data of the face.
+	if (font->workerFonts != NULL) {
+		int i;
+		for (i = 0; i < font->nworkerFonts; i++)
+			font__tt_freeFont(&font->workerFonts[i]);
+		free(font->workerFonts);
+	}
+#endif
+	font__releaseFace(font->face);
 	free(font);
 }
 
+#ifdef FONT_TT_WORKERS
+static void font__freeWorkers(FONTcontext* stash)
+{
+	int i;
+	for (i = 0; i < stash->nworkers; i++) {
+		font__tt_freeWorker(&stash->workers[i].tt);
+		if (stash->workers[i].scratch) free(stash->workers[i].scratch);
+	}
+	if (stash->workers) free(stash->workers);
+	stash->workers = NULL;
+	stash->nworkers = 0;
+}
+
+// Workers are created on first use, returns 0 on failure.
+static int font__initWorkers(FONTcontext* stash)
+{
+	int i;
+	if (stash->workers != NULL) return 1;
+
+	stash->workers = (FONTworker*)calloc(stash->params.workers, sizeof(FONTworker));
+	if (stash->workers == NULL) return 0;
+	stash->nworkers = stash->params.workers;
+	for (i = 0; i < stash->nworkers; i++) {
+		stash->workers[i].scratch = (unsigned char*)malloc(FONT_SCRATCH_BUF_SIZE);
+		if (stash->workers[i].scratch == NULL) goto error;
+		if (!font__tt_initWorker(&stash->workers[i].tt)) goto error;
+	}
+	return 1;
+
+error:
+	font__freeWorkers(stash);
+	return 0;
+}
+#endif
+
+static const unsigned short* font__buildCmapPage(FONTface* face, unsigned int page)
+{
+	int i, empty = 1;
+	unsigned short* glyphs = (unsigned short*)malloc(sizeof(unsigned short) * 256);
+	if (glyphs == NULL) return NULL;
+	for (i = 0; i < 256; i++) {
+		int g = font__tt_getGlyphIndex(&face->font, (int)(page << 8) + i);
+		glyphs[i] = (unsigned short)g;
+		if (g != 0) empty = 0;
+	}
+	// Pages without glyphs share one empty page.
+	if (empty) {
+		free(glyphs);
+		face->cmapPages[page] = font__emptyCmapPage;
+	} else {
+		face->cmapPages[page] = glyphs;
+	}
+	return face->cmapPages[page];
+}
+
+// Returns the glyph index of the code point in the font, 0 if the font does not have it.
+static int font__getGlyphIndex(FONTface* face, unsigned int codepoint)
+{
+	int lo, hi;
+	if (codepoint < 0x10000) {
+		const unsigned short* page = face->cmapPages[codepoint >> 8];
+		if (page == NULL)
+			page = font__buildCmapPage(face, codepoint >> 8);
+		if (page == NULL)
+			return font__tt_getGlyphIndex(&face->font, (int)codepoint);
+		return page[codepoint & 0xff];
+	}
+
+	if (face->cmapRangesState == 0)
+		face->cmapRangesState = font__tt_getCmapRanges(&face->font, &face->cmapRanges, &face->ncmapRanges) ? 1 : -1;
+	if (face->cmapRangesState < 0)
+		return font__tt_getGlyphIndex(&face->font, (int)codepoint);
+
+	// Binary search.
+	lo = 0;
+	hi = face->ncmapRanges - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) >> 1;
+		const FONTcmapRange* range = &face->cmapRanges[mid];
+		if (codepoint < range->first)
+			hi = mid - 1;
+		else if (codepoint > range->last)
+			lo = mid + 1;
+		else
+			return range->constant ? range->glyph : range->glyph + (int)(codepoint - range->first);
+	}
+	return 0;
+}
+
 static int font__allocFont(FONTcontext* stash)
 {
 	FONTfont* font = NULL;
@@ -916,74 +2450,234 @@ static FILE* font__fopen(const char* filename, const char* mode)
 #endif
 }
 
-int fontAddFont(FONTcontext* stash, const char* name, const char* path)
+#ifdef FONT_MMAP
+static unsigned char* font__mapFile(const char* path, int* dataSize)
+{
+	struct stat st;
+	void* data;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return NULL;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || (off_t)(int)st.st_size != st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	// The mapping stays valid after the file is closed.
+	data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return NULL;
+	*dataSize = (int)st.st_size;
+	return (unsigned char*)data;
+}
+#endif
+
+// Precomputes the kerning between printable ASCII characters, in font units so that it is built
+// before any size is set. Pairs where either character is missing from the font are marked
+// FONT_ASCII_KERN_NONE, and looked up as usual.
+static void font__buildAsciiKern(FONTface* face)
+{
+	int i, j, glyphs[FONT_ASCII_KERN_COUNT];
+
+	face->asciiKern = (short*)malloc(sizeof(short) * FONT_ASCII_KERN_COUNT * FONT_ASCII_KERN_COUNT);
+	if (face->asciiKern == NULL) return;
+
+	for (i = 0; i < FONT_ASCII_KERN_COUNT; i++)
+		glyphs[i] = font__getGlyphIndex(face, FONT_ASCII_KERN_FIRST + i);
+	for (i = 0; i < FONT_ASCII_KERN_COUNT; i++) {
+		short* row = &face->asciiKern[i * FONT_ASCII_KERN_COUNT];
+		for (j = 0; j < FONT_ASCII_KERN_COUNT; j++) {
+			if (glyphs[i] != 0 && glyphs[j] != 0)
+				row[j] = (short)font__tt_getGlyphKernAdvance(&face->font, glyphs[i], glyphs[j]);
+			else
+				row[j] = FONT_ASCII_KERN_NONE;
+		}
+	}
+}
+
+// Returns the flags of the stash that the face is loaded with, faces are only shared between stashes with the same flags.
+static int font__faceFlags(FONTcontext* stash)
+{
+	return stash->params.flags & FONT_FLATTEN_KERNING;
+}
+
+// Returns a new face with one reference for the font file or buffer, the data is released on failure.
+// The font is parsed by font__faceLoaded().
+static FONTface* font__createFace(FONTcontext* stash, const char* path, unsigned char* data, int dataSize, int owner)
+{
+	FONTface* face = (FONTface*)calloc(1, sizeof(FONTface));
+	if (face == NULL) {
+		font__freeData(data, dataSize, owner);
+		return NULL;
+	}
+	face->refs = 1;
+	face->data = data;
+	face->dataSize = dataSize;
+	face->freeData = (unsigned char)owner;
+	face->flags = font__faceFlags(stash);
+	if (path != NULL) {
+		face->path = (char*)malloc(strlen(path)+1);
+		if (face->path == NULL) {
+			font__freeFace(face);
+			return NULL;
+		}
+		strcpy(face->path, path);
+	}
+
+	if (stash->params.registry != NULL) {
+		face->registry = stash->params.registry;
+		face->next = face->registry->faces;
+		face->registry->faces = face;
+	}
+	return face;
+}
+
+// Maps or reads the font file, returns 0 on failure.
+static int font__readFile(const char* path, unsigned char** data, int* dataSize, int* owner)
 {
 	FILE* fp = 0;
-	int dataSize = 0, readed;
-	unsigned char* data = NULL;
+	int readed;
+
+#ifdef FONT_MMAP
+	// Files that cannot be mapped are read as usual.
+	*data = font__mapFile(path, dataSize);
+	if (*data != NULL) {
+		*owner = FONT_DATA_UNMAP;
+		return 1;
+	}
+#endif
 
 	// Read in the font data.
+	*data = NULL;
 	fp = font__fopen(path, "rb");
 	if (fp == NULL) goto error;
 	fseek(fp,0,SEEK_END);
-	dataSize = (int)ftell(fp);
+	*dataSize = (int)ftell(fp);
 	fseek(fp,0,SEEK_SET);
-	data = (unsigned char*)malloc(dataSize);
-	if (data == NULL) goto error;
-	readed = fread(data, 1, dataSize, fp);
+	*data = (unsigned char*)malloc(*dataSize);
+	if (*data == NULL) goto error;
+	readed = fread(*data, 1, *dataSize, fp);
 	fclose(fp);
 	fp = 0;
-	if (readed != dataSize) goto error;
-
-	return fontAddFontMem(stash, name, data, dataSize, 1);
+	if (readed != *dataSize) goto error;
+	*owner = FONT_DATA_FREE;
+	return 1;
 
 error:
-	if (data) free(data);
+	if (*data) free(*data);
+	*data = NULL;
 	if (fp) fclose(fp);
-	return FONT_INVALID;
+	return 0;
 }
 
-int fontAddFontMem(FONTcontext* stash, const char* name, unsigned char* data, int dataSize, int freeData)
+static int font__loadFace(FONTcontext* stash, FONTface* face)
+{
+	int ascent, descent, fh, lineGap, owner;
+
+	if (face->data == NULL) {
+		if (face->path == NULL || !font__readFile(face->path, &face->data, &face->dataSize, &owner))
+			return 0;
+		face->freeData = (unsigned char)owner;
+	}
+
+	// Init font
+	stash->nscratch = 0;
+	if (!font__tt_loadFont(stash, &face->font, face->data, face->dataSize)) return 0;
+	if (face->flags & FONT_FLATTEN_KERNING)
+		font__tt_flattenKerning(&face->font);
+	face->hasKerning = font__tt_hasKerning(&face->font);
+	if (face->hasKerning)
+		font__buildAsciiKern(face);
+
+	// Store normalized line height. The real line height is got
+	// by multiplying the lineh by font size.
+	font__tt_getFontVMetrics( &face->font, &ascent, &descent, &lineGap);
+	fh = ascent - descent;
+	face->ascender = (float)ascent / (float)fh;
+	face->descender = (float)descent / (float)fh;
+	face->lineh = (float)(fh + lineGap) / (float)fh;
+	return 1;
+}
+
+// Loads the font the first time it is needed, returns 0 if it cannot be loaded.
+static int font__faceLoaded(FONTcontext* stash, FONTface* face)
+{
+	if (face->state == 0)
+		face->state = font__loadFace(stash, face) ? 1 : -1;
+	return face->state > 0;
+}
+
+// Returns the face of the registry added from the path, or from the buffer if path is NULL, with a new reference.
+// Only faces loaded with the same flags match.
+static FONTface* font__findFace(FONTcontext* stash, const char* path, const unsigned char* data, int dataSize)
+{
+	FONTregistry* registry = stash->params.registry;
+	FONTface* face;
+	if (registry == NULL) return NULL;
+	for (face = registry->faces; face != NULL; face = face->next) {
+		if (face->flags != font__faceFlags(stash)) continue;
+		if (path != NULL && (face->path == NULL || strcmp(face->path, path) != 0)) continue;
+		if (path == NULL && (face->path != NULL || face->data != data || face->dataSize != dataSize)) continue;
+		face->refs++;
+		return face;
+	}
+	return NULL;
+}
+
+// Adds a font using the face, the reference to the face is passed to the font.
+static int font__addFontFace(FONTcontext* stash, const char* name, FONTface* face)
 {
-	int i, ascent, descent, fh, lineGap;
+	int i;
 	FONTfont* font;
+	int idx;
 
-	int idx = font__allocFont(stash);
-	if (idx == FONT_INVALID)
+	if (face == NULL) return FONT_INVALID;
+	// With FONT_LAZY_LOAD the font is loaded when it is first used.
+	if (!(stash->params.flags & FONT_LAZY_LOAD) && !font__faceLoaded(stash, face)) {
+		font__releaseFace(face);
 		return FONT_INVALID;
+	}
+
+	idx = font__allocFont(stash);
+	if (idx == FONT_INVALID) {
+		font__releaseFace(face);
+		return FONT_INVALID;
+	}
 
 	font = stash->fonts[idx];
+	font->face = face;
 
 	strncpy(font->name, name, sizeof(font->name));
 	font->name[sizeof(font->name)-1] = '\0';
 
 	// Init hash lookup.
-	for (i = 0; i < FONT_HASH_LUT_SIZE; ++i)
+	for (i = 0; i < FONT_HASH_LUT_SIZE; ++i) {
 		font->lut[i] = -1;
-
-	// Read in the font data.
-	font->dataSize = dataSize;
-	font->data = data;
-	font->freeData = (unsigned char)freeData;
-
-	// Init font
-	stash->nscratch = 0;
-	if (!font__tt_loadFont(stash, &font->font, data, dataSize)) goto error;
-
-	// Store normalized line height. The real line height is got
-	// by multiplying the lineh by font size.
-	font__tt_getFontVMetrics( &font->font, &ascent, &descent, &lineGap);
-	fh = ascent - descent;
-	font->ascender = (float)ascent / (float)fh;
-	font->descender = (float)descent / (float)fh;
-	font->lineh = (float)(fh + lineGap) / (float)fh;
+		font->refLut[i] = -1;
+		font->codepointLut[i] = -1;
+	}
 
 	return idx;
+}
 
-error:
-	font__freeFont(font);
-	stash->nfonts--;
-	return FONT_INVALID;
+int fontAddFont(FONTcontext* stash, const char* name, const char* path)
+{
+	// Files already added by a context using the registry are not read again.
+	FONTface* face = font__findFace(stash, path, NULL, 0);
+	if (face == NULL)
+		face = font__createFace(stash, path, NULL, 0, FONT_DATA_KEEP);
+	return font__addFontFace(stash, name, face);
+}
+
+int fontAddFontMem(FONTcontext* stash, const char* name, unsigned char* data, int dataSize, int freeData)
+{
+	FONTface* face = font__findFace(stash, NULL, data, dataSize);
+	if (face != NULL) {
+		// The buffer is freed with the face if any of the fonts using it was given the ownership.
+		if (freeData && face->freeData == FONT_DATA_KEEP)
+			face->freeData = FONT_DATA_FREE;
+	} else {
+		face = font__createFace(stash, NULL, data, dataSize, freeData ? FONT_DATA_FREE : FONT_DATA_KEEP);
+	}
+	return font__addFontFace(stash, name, face);
 }
 
 int fontGetFontByName(FONTcontext* s, const char* name)
@@ -1008,13 +2702,45 @@ static FONTglyph* font__allocGlyph(FONTfont* font)
 	return &font->glyphs[font->nglyphs-1];
 }
 
+static FONTcodepoint* font__allocCodepoint(FONTfont* font)
+{
+	if (font->ncodepoints+1 > font->ccodepoints) {
+		FONTcodepoint* codepoints;
+		int ccodepoints = font->ccodepoints == 0 ? FONT_INIT_GLYPHS : font->ccodepoints * 2;
+		codepoints = (FONTcodepoint*)realloc(font->codepoints, sizeof(FONTcodepoint) * ccodepoints);
+		if (codepoints == NULL) return NULL;
+		font->codepoints = codepoints;
+		font->ccodepoints = ccodepoints;
+	}
+	font->ncodepoints++;
+	return &font->codepoints[font->ncodepoints-1];
+}
+
+static FONTglyphRef* font__allocGlyphRef(FONTfont* font)
+{
+	if (font->nrefs+1 > font->crefs) {
+		FONTglyphRef* refs;
+		int crefs = font->crefs == 0 ? FONT_INIT_GLYPHS : font->crefs * 2;
+		refs = (FONTglyphRef*)realloc(font->refs, sizeof(FONTglyphRef) * crefs);
+		if (refs == NULL) return NULL;
+		font->refs = refs;
+		font->crefs = crefs;
+	}
+	font->nrefs++;
+	return &font->refs[font->nrefs-1];
+}
+
 
 // Based on Exponential blur, Jani Huhtanen, 2006
+//
+// The SIMD paths run the same fixed point recurrence as the scalar code, one image column per lane,
+// and produce bit identical results. The horizontal passes are done by transposing the glyph into
+// the scratch buffer and running the vertical kernel over it, so every pass walks memory row by row.
 
 #define APREC 16
 #define ZPREC 7
 
-static void font__blurCols(unsigned char* dst, int w, int h, int dstStride, int alpha)
+static void font__blurColsScalar(unsigned char* dst, int w, int h, int dstStride, int alpha)
 {
 	int x, y;
 	for (y = 0; y < h; y++) {
@@ -1034,7 +2760,7 @@ static void font__blurCols(unsigned char* dst, int w, int h, int dstStride, int
 	}
 }
 
-static void font__blurRows(unsigned char* dst, int w, int h, int dstStride, int alpha)
+static void font__blurRowsScalar(unsigned char* dst, int w, int h, int dstStride, int alpha)
 {
 	int x, y;
 	for (x = 0; x < w; x++) {
@@ -1054,12 +2780,181 @@ static void font__blurRows(unsigned char* dst, int w, int h, int dstStride, int
 	}
 }
 
+// The filter state z stays within [0, 255<<ZPREC], so it fits in 16 bits. SSE2 and AVX2 lack a 32 bit
+// multiply, the product alpha*(x-z) is done with madd on (d,d)*(a0,a1) pairs where a0+a1 == alpha.
+// Both halves fit in a signed short since alpha is always below 0.77*(1<<APREC).
+
+#ifdef FONT_SIMD_SSE2
+
+static __inline __m128i font__blurStepSSE2(__m128i z, __m128i src, __m128i alpha)
+{
+	__m128i d = _mm_sub_epi16(_mm_slli_epi16(src, ZPREC), z);
+	__m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(d, d), alpha), APREC);
+	__m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(d, d), alpha), APREC);
+	return _mm_add_epi16(z, _mm_packs_epi32(lo, hi));
+}
 
-static void font__blur(FONTcontext* stash, unsigned char* dst, int w, int h, int dstStride, int blur)
+static __inline void font__blurRowSSE2(unsigned char* row, __m128i* z0, __m128i* z1, __m128i alpha)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i px = _mm_loadu_si128((const __m128i*)row);
+	*z0 = font__blurStepSSE2(*z0, _mm_unpacklo_epi8(px, zero), alpha);
+	*z1 = font__blurStepSSE2(*z1, _mm_unpackhi_epi8(px, zero), alpha);
+	_mm_storeu_si128((__m128i*)row, _mm_packus_epi16(_mm_srli_epi16(*z0, ZPREC), _mm_srli_epi16(*z1, ZPREC)));
+}
+
+// Blurs 16 adjacent columns.
+static void font__blurBlockSSE2(unsigned char* dst, int h, int dstStride, int alpha)
+{
+	__m128i va = _mm_set1_epi32((alpha - (alpha >> 1)) << 16 | (alpha >> 1));
+	__m128i z0 = _mm_setzero_si128(), z1 = _mm_setzero_si128();
+	int y;
+	for (y = 1; y < h; y++)
+		font__blurRowSSE2(dst + y*dstStride, &z0, &z1, va);
+	memset(dst + (h-1)*dstStride, 0, 16); // force zero border
+	z0 = z1 = _mm_setzero_si128();
+	for (y = h-2; y >= 0; y--)
+		font__blurRowSSE2(dst + y*dstStride, &z0, &z1, va);
+	memset(dst, 0, 16); // force zero border
+}
+
+#endif // FONT_SIMD_SSE2
+
+#ifdef FONT_SIMD_AVX2
+
+static __inline __m256i font__blurStepAVX2(__m256i z, __m256i src, __m256i alpha)
+{
+	__m256i d = _mm256_sub_epi16(_mm256_slli_epi16(src, ZPREC), z);
+	__m256i lo = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(d, d), alpha), APREC);
+	__m256i hi = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(d, d), alpha), APREC);
+	return _mm256_add_epi16(z, _mm256_packs_epi32(lo, hi));
+}
+
+static __inline void font__blurRowAVX2(unsigned char* row, __m256i* z0, __m256i* z1, __m256i alpha)
+{
+	__m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)row));
+	__m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row+16)));
+	__m256i out;
+	*z0 = font__blurStepAVX2(*z0, a, alpha);
+	*z1 = font__blurStepAVX2(*z1, b, alpha);
+	// packus works per 128 bit lane, put the quadwords back in order.
+	out = _mm256_packus_epi16(_mm256_srli_epi16(*z0, ZPREC), _mm256_srli_epi16(*z1, ZPREC));
+	_mm256_storeu_si256((__m256i*)row, _mm256_permute4x64_epi64(out, 0xd8));
+}
+
+// Blurs 32 adjacent columns.
+static void font__blurBlockAVX2(unsigned char* dst, int h, int dstStride, int alpha)
+{
+	__m256i va = _mm256_set1_epi32((alpha - (alpha >> 1)) << 16 | (alpha >> 1));
+	__m256i z0 = _mm256_setzero_si256(), z1 = _mm256_setzero_si256();
+	int y;
+	for (y = 1; y < h; y++)
+		font__blurRowAVX2(dst + y*dstStride, &z0, &z1, va);
+	memset(dst + (h-1)*dstStride, 0, 32); // force zero border
+	z0 = z1 = _mm256_setzero_si256();
+	for (y = h-2; y >= 0; y--)
+		font__blurRowAVX2(dst + y*dstStride, &z0, &z1, va);
+	memset(dst, 0, 32); // force zero border
+}
+
+#endif // FONT_SIMD_AVX2
+
+#ifdef FONT_SIMD_NEON
+
+// NEON has a 32 bit multiply, the state is kept in 32 bit lanes.
+static __inline int32x4_t font__blurStepNEON(int32x4_t z, uint16x4_t src, int32x4_t alpha)
+{
+	int32x4_t d = vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(src)), z);
+	return vaddq_s32(z, vshrq_n_s32(vmulq_s32(d, alpha), APREC));
+}
+
+static __inline void font__blurRowNEON(unsigned char* row, int32x4_t* z, int32x4_t alpha)
+{
+	uint8x16_t px = vld1q_u8(row);
+	uint16x8_t lo = vshll_n_u8(vget_low_u8(px), ZPREC);
+	uint16x8_t hi = vshll_n_u8(vget_high_u8(px), ZPREC);
+	int16x8_t outlo, outhi;
+	z[0] = font__blurStepNEON(z[0], vget_low_u16(lo), alpha);
+	z[1] = font__blurStepNEON(z[1], vget_high_u16(lo), alpha);
+	z[2] = font__blurStepNEON(z[2], vget_low_u16(hi), alpha);
+	z[3] = font__blurStepNEON(z[3], vget_high_u16(hi), alpha);
+	outlo = vcombine_s16(vshrn_n_s32(z[0], ZPREC), vshrn_n_s32(z[1], ZPREC));
+	outhi = vcombine_s16(vshrn_n_s32(z[2], ZPREC), vshrn_n_s32(z[3], ZPREC));
+	vst1q_u8(row, vcombine_u8(vqmovun_s16(outlo), vqmovun_s16(outhi)));
+}
+
+// Blurs 16 adjacent columns.
+static void font__blurBlockNEON(unsigned char* dst, int h, int dstStride, int alpha)
+{
+	int32x4_t va = vdupq_n_s32(alpha);
+	int32x4_t z[4];
+	int y, i;
+	for (i = 0; i < 4; i++) z[i] = vdupq_n_s32(0);
+	for (y = 1; y < h; y++)
+		font__blurRowNEON(dst + y*dstStride, z, va);
+	memset(dst + (h-1)*dstStride, 0, 16); // force zero border
+	for (i = 0; i < 4; i++) z[i] = vdupq_n_s32(0);
+	for (y = h-2; y >= 0; y--)
+		font__blurRowNEON(dst + y*dstStride, z, va);
+	memset(dst, 0, 16); // force zero border
+}
+
+#endif // FONT_SIMD_NEON
+
+static void font__blurRows(unsigned char* dst, int w, int h, int dstStride, int alpha)
+{
+	int x = 0;
+#ifdef FONT_SIMD_AVX2
+	for (; x+32 <= w; x += 32)
+		font__blurBlockAVX2(dst + x, h, dstStride, alpha);
+#endif
+#ifdef FONT_SIMD_SSE2
+	for (; x+16 <= w; x += 16)
+		font__blurBlockSSE2(dst + x, h, dstStride, alpha);
+#endif
+#ifdef FONT_SIMD_NEON
+	for (; x+16 <= w; x += 16)
+		font__blurBlockNEON(dst + x, h, dstStride, alpha);
+#endif
+	if (x < w)
+		font__blurRowsScalar(dst + x, w - x, h, dstStride, alpha);
+}
+
+#if defined(FONT_SIMD_SSE2) || defined(FONT_SIMD_NEON)
+static void font__transpose(unsigned char* dst, int dstStride, const unsigned char* src, int w, int h, int srcStride)
+{
+	int x, y;
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++)
+			dst[x*dstStride + y] = src[x];
+		src += srcStride;
+	}
+}
+#endif
+
+static void font__blurCols(unsigned char* scratch, unsigned char* dst, int w, int h, int dstStride, int alpha)
+{
+#if defined(FONT_SIMD_SSE2) || defined(FONT_SIMD_NEON)
+	// Transpose into scratch memory, blur the columns with the vertical kernel, and transpose back.
+	if (h >= 16 && w*h <= FONT_SCRATCH_BUF_SIZE) {
+		unsigned char* tmp = scratch;
+		font__transpose(tmp, h, dst, w, h, dstStride);
+		font__blurRows(tmp, h, w, h, alpha);
+		font__transpose(dst, dstStride, tmp, h, w, h);
+		return;
+	}
+#else
+	FONT_NOTUSED(scratch);
+#endif
+	font__blurColsScalar(dst, w, h, dstStride, alpha);
+}
+
+
+// Scratch memory of FONT_SCRATCH_BUF_SIZE bytes is used for the column pass.
+static void font__blur(unsigned char* scratch, unsigned char* dst, int w, int h, int dstStride, int blur)
 {
 	int alpha;
 	float sigma;
-	(void)stash;
 
 	if (blur < 1)
 		return;
@@ -1067,62 +2962,110 @@ static void font__blur(FONTcontext* stash, unsigned char* dst, int w, int h, int
 	sigma = (float)blur * 0.57735f; // 1 / sqrt(3)
 	alpha = (int)((1<<APREC) * (1.0f - expf(-2.3f / (sigma+1.0f))));
 	font__blurRows(dst, w, h, dstStride, alpha);
-	font__blurCols(dst, w, h, dstStride, alpha);
+	font__blurCols(scratch, dst, w, h, dstStride, alpha);
 	font__blurRows(dst, w, h, dstStride, alpha);
-	font__blurCols(dst, w, h, dstStride, alpha);
-//	font__blurrows(dst, w, h, dstStride, alpha);
-//	font__blurcols(dst, w, h, dstStride, alpha);
+	font__blurCols(scratch, dst, w, h, dstStride, alpha);
 }
 
-static FONTglyph* font__getGlyph(FONTcontext* stash, FONTfont* font, unsigned int codepoint,
-								 short isize, short iblur)
+static int font__findGlyph(FONTfont* font, int g, short isize, short iblur)
 {
-	int i, g, advance, lsb, x0, y0, x1, y1, gw, gh, gx, gy, x, y;
-	float scale;
-	FONTglyph* glyph = NULL;
-	unsigned int h;
-	float size = isize/10.0f;
-	int pad, added;
-	unsigned char* bdst;
-	unsigned char* dst;
-	FONTfont* renderFont = font;
-
-	if (isize < 2) return NULL;
-	if (iblur > 20) iblur = 20;
-	pad = iblur+2;
-
-	// Reset allocator.
-	stash->nscratch = 0;
-
-	// Find code point and size.
-	h = font__hashint(codepoint) & (FONT_HASH_LUT_SIZE-1);
-	i = font->lut[h];
+	unsigned int h = font__hashint((unsigned int)g) & (FONT_HASH_LUT_SIZE-1);
+	int i = font->lut[h];
 	while (i != -1) {
-		if (font->glyphs[i].codepoint == codepoint && font->glyphs[i].size == isize && font->glyphs[i].blur == iblur)
-			return &font->glyphs[i];
+		if (font->glyphs[i].index == g && font->glyphs[i].size == isize && font->glyphs[i].blur == iblur)
+			return i;
 		i = font->glyphs[i].next;
 	}
+	return -1;
+}
 
-	// Could not find glyph, create it.
-	g = font__tt_getGlyphIndex(&font->font, codepoint);
-	// Try to find the glyph in fallback fonts.
-	if (g == 0) {
-		for (i = 0; i < font->nfallbacks; ++i) {
-			FONTfont* fallbackFont = stash->fonts[font->fallbacks[i]];
-			int fallbackIndex = font__tt_getGlyphIndex(&fallbackFont->font, codepoint);
-			if (fallbackIndex != 0) {
-				g = fallbackIndex;
-				renderFont = fallbackFont;
-				break;
-			}
+int fontSetSizePolicy(FONTcontext* stash, int policy, const float* buckets, int nbuckets)
+{
+	short* sizes = NULL;
+	int i;
+	if (stash == NULL) return 0;
+	if (policy != FONT_SIZE_EXACT && policy != FONT_SIZE_BUCKETS && policy != FONT_SIZE_SQRT2) return 0;
+
+	if (policy == FONT_SIZE_BUCKETS) {
+		if (buckets == NULL || nbuckets <= 0) return 0;
+		// The buckets must be positive and strictly increasing.
+		for (i = 0; i < nbuckets; i++) {
+			if (!(buckets[i] > 0.0f) || buckets[i] >= 3276.0f) return 0;
+			if (i > 0 && !(buckets[i] > buckets[i-1])) return 0;
 		}
-		// It is possible that we did not find a fallback glyph.
-		// In that case the glyph index 'g' is 0, and we'll proceed below and cache empty glyph.
+		sizes = (short*)malloc(sizeof(short) * nbuckets);
+		if (sizes == NULL) return 0;
+		for (i = 0; i < nbuckets; i++)
+			sizes[i] = (short)(buckets[i]*10.0f);
 	}
-	scale = font__tt_getPixelHeightScale(&renderFont->font, size);
-	font__tt_buildGlyphBitmap(&renderFont->font, g, size, scale, &advance, &lsb, &x0, &y0, &x1, &y1);
-	gw = x1-x0 + pad*2;
-	gh = y1-y0 + pad*2;
+
+	if (stash->sizeBuckets != NULL) free(stash->sizeBuckets);
+	stash->sizeBuckets = sizes;
+	stash->nsizeBuckets = sizes != NULL ? nbuckets : 0;
+	stash->sizePolicy = policy;
+	return 1;
+}
+
+// Returns the size a glyph requested at isize is rasterized at.
+static short font__snapSize(FONTcontext* stash, short isize)
+{
+	int i;
+	float s;
+	if (stash->sizePolicy == FONT_SIZE_BUCKETS) {
+		for (i = 0; i < stash->nsizeBuckets; i++) {
+			if (stash->sizeBuckets[i] >= isize)
+				return stash->sizeBuckets[i];
+		}
+		// Larger than the largest bucket, rasterize at the exact size.
+		return isize;
+	} else if (stash->sizePolicy == FONT_SIZE_SQRT2) {
+		s = 1.0f;
+		while (s*10.0f < isize && s < 3276.0f)
+			s *= 1.41421356f;
+		return (short)font__maxi((int)(s*10.0f + 0.5f), isize);
+	}
+	return isize;
+}
+
+// Applies the distance field size and the size policy to the glyph size and blur.
+static void font__glyphSize(FONTcontext* stash, short* isize, short* iblur)
+{
+	if (*iblur > 20) *iblur = 20;
+
+	// A single distance field serves all sizes.
+	if (stash->params.flags & FONT_SDF) {
+		*isize = FONT_SDF_SIZE*10;
+		*iblur = 0;
+	} else if (stash->sizePolicy != FONT_SIZE_EXACT) {
+		// Snap the size, and keep the blur the same relative to the glyph.
+		short rsize = font__snapSize(stash, *isize);
+		*iblur = (short)((*iblur * rsize + *isize/2) / *isize);
+		if (*iblur > 20) *iblur = 20;
+		*isize = rsize;
+	}
+}
+
+// Returns the padding of a glyph with the blur, and the resolution shift and blur it is rasterized with.
+static int font__glyphPadding(FONTcontext* stash, short iblur, int* shift, int* rblur)
+{
+	*shift = 0;
+	// Large blur destroys the detail of the glyph anyway, rasterize and blur it at lower resolution.
+	if (stash->params.flags & FONT_LOWRES_BLUR) {
+		while (*shift < FONT_LOWRES_MAX_LEVEL && (iblur >> (*shift+1)) >= FONT_LOWRES_MIN_BLUR)
+			(*shift)++;
+	}
+	*rblur = (iblur + ((1 << *shift) >> 1)) >> *shift;
+	// The distance field has its own padding, the one pixel border is for the quad inset.
+	return (stash->params.flags & FONT_SDF) ? 1 : *rblur+2;
+}
+
+// Finds room for the glyph box in the atlas and adds the glyph to the font, the bitmap is left to the caller.
+static FONTglyph* font__addGlyph(FONTcontext* stash, FONTfont* font, int g, short isize, short iblur, int shift, int pad,
+								 short xadv, int advance, int x0, int y0, int x1, int y1)
+{
+	int gw = x1-x0 + pad*2, gh = y1-y0 + pad*2, gx, gy, added;
+	unsigned int h = font__hashint((unsigned int)g) & (FONT_HASH_LUT_SIZE-1);
+	FONTglyph* glyph;
 
 	// Find free spot for the rect in the atlas
 	added = font__atlasAddRect(stash->atlas, gw, gh, &gx, &gy);
@@ -1135,7 +3078,7 @@ static FONTglyph* font__getGlyph(FONTcontext* stash, FONTfont* font, unsigned in
 
 	// Init glyph.
 	glyph = font__allocGlyph(font);
-	glyph->codepoint = codepoint;
+	if (glyph == NULL) return NULL;
 	glyph->size = isize;
 	glyph->blur = iblur;
 	glyph->index = g;
@@ -1143,19 +3086,112 @@ static FONTglyph* font__getGlyph(FONTcontext* stash, FONTfont* font, unsigned in
 	glyph->y0 = (short)gy;
 	glyph->x1 = (short)(glyph->x0+gw);
 	glyph->y1 = (short)(glyph->y0+gh);
-	glyph->xadv = (short)(scale * advance * 10.0f);
+	glyph->xadv = xadv;
 	glyph->xoff = (short)(x0 - pad);
 	glyph->yoff = (short)(y0 - pad);
+	glyph->shift = (short)shift;
+	glyph->advance = (unsigned short)advance;
+	glyph->font = font;
 	glyph->next = 0;
 
-	// Insert char to hash lookup.
-	glyph->next = font->lut[h];
-	font->lut[h] = font->nglyphs-1;
+	// Insert glyph to hash lookup.
+	glyph->next = font->lut[h];
+	font->lut[h] = font->nglyphs-1;
+
+	stash->dirtyRect[0] = font__mini(stash->dirtyRect[0], glyph->x0);
+	stash->dirtyRect[1] = font__mini(stash->dirtyRect[1], glyph->y0);
+	stash->dirtyRect[2] = font__maxi(stash->dirtyRect[2], glyph->x1);
+	stash->dirtyRect[3] = font__maxi(stash->dirtyRect[3], glyph->y1);
+
+	return glyph;
+}
+
+// Returns the bitmap of glyph index g of the font, rasterizing it to the atlas if needed.
+static FONTglyph* font__getGlyphBitmap(FONTcontext* stash, FONTfont* font, int g, short isize, short iblur)
+{
+	int i, advance, lsb, x0, y0, x1, y1, gw, gh, x, y;
+	float scale = 0, size = isize/10.0f;
+	FONTglyph* glyph = NULL;
+	int pad, sharp = -1, sx = 0, sy = 0, shift, rblur, sdfStride = 0;
+	int sdf = (stash->params.flags & FONT_SDF) != 0;
+	short xadv;
+	unsigned char* bdst;
+	unsigned char* dst;
+	const unsigned char* sdfData = NULL;
+
+	pad = font__glyphPadding(stash, iblur, &shift, &rblur);
+
+	// Reset allocator.
+	stash->nscratch = 0;
+
+	// Find glyph and size.
+	i = font__findGlyph(font, g, isize, iblur);
+	if (i != -1)
+		return &font->glyphs[i];
+
+	// Blurred glyphs are made from the sharp version of the glyph when it is already in the atlas,
+	// so drawing a shadow under a text does not decode and rasterize the outlines again.
+	if (iblur > 0 && shift == 0)
+		sharp = font__findGlyph(font, g, isize, 0);
+
+	if (sharp != -1) {
+		// The sharp glyph is stored with 2px padding.
+		FONTglyph* src = &font->glyphs[sharp];
+		sx = src->x0 + 2;
+		sy = src->y0 + 2;
+		x0 = src->xoff + 2;
+		y0 = src->yoff + 2;
+		x1 = x0 + (src->x1 - src->x0 - 4);
+		y1 = y0 + (src->y1 - src->y0 - 4);
+		xadv = src->xadv;
+		advance = src->advance;
+	} else {
+		// Could not find glyph, create it.
+		font__tt_setContext(&font->face->font, stash);
+		scale = font__tt_getPixelHeightScale(&font->face->font, size);
+		if (sdf)
+			sdfData = font__tt_buildGlyphSDF(&font->face->font, g, size, scale, FONT_SDF_PADDING, FONT_SDF_ONEDGE,
+											 &advance, &x0, &y0, &x1, &y1, &sdfStride);
+		else if (!font__tt_buildGlyphBitmap(&font->face->font, g, size / (1 << shift), scale / (1 << shift), &advance, &lsb, &x0, &y0, &x1, &y1))
+			return NULL;
+		xadv = (short)(scale * advance * 10.0f);
+		scale /= (1 << shift);
+	}
+	gw = x1-x0 + pad*2;
+	gh = y1-y0 + pad*2;
+
+	glyph = font__addGlyph(stash, font, g, isize, iblur, shift, pad, xadv, advance, x0, y0, x1, y1);
+	if (glyph == NULL) return NULL;
+
+	if (sharp != -1) {
+		// Making room may have reset the atlas, which drops the sharp glyph.
+		sharp = font__findGlyph(font, g, isize, 0);
+		if (sharp != -1) {
+			sx = font->glyphs[sharp].x0 + 2;
+			sy = font->glyphs[sharp].y0 + 2;
+		} else {
+			font__tt_setContext(&font->face->font, stash);
+			scale = font__tt_getPixelHeightScale(&font->face->font, size);
+			if (!font__tt_buildGlyphBitmap(&font->face->font, g, size, scale, &advance, &lsb, &x0, &y0, &x1, &y1))
+				scale = 0;
+		}
+	}
 
 	// Rasterize
 	dst = &stash->texData[(glyph->x0+pad) + (glyph->y0+pad) * stash->params.width];
-	font__tt_renderGlyphBitmap(&renderFont->font, dst, gw-pad*2,gh-pad*2, stash->params.width, scale,scale, g);
-
+	if (sharp != -1) {
+		// The atlas is cleared when it is reset, only the coverage needs to be copied.
+		const unsigned char* src = &stash->texData[sx + sy * stash->params.width];
+		for (y = 0; y < gh-pad*2; y++)
+			memcpy(&dst[y * stash->params.width], &src[y * stash->params.width], gw-pad*2);
+	} else if (sdf) {
+		if (sdfData != NULL) {
+			for (y = 0; y < gh-pad*2; y++)
+				memcpy(&dst[y * stash->params.width], &sdfData[y * sdfStride], gw-pad*2);
+		}
+	} else if (scale > 0) {
+		font__tt_renderGlyphBitmap(&font->face->font, dst, gw-pad*2,gh-pad*2, stash->params.width, scale,scale, g);
+	}
 	// Make sure there is one pixel empty border.
 	dst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
 	for (y = 0; y < gh; y++) {
@@ -1178,36 +3214,159 @@ static FONTglyph* font__getGlyph(FONTcontext* stash, FONTfont* font, unsigned in
 	}*/
 
 	// Blur
-	if (iblur > 0) {
+	if (rblur > 0) {
 		stash->nscratch = 0;
 		bdst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
-		font__blur(stash, bdst, gw,gh, stash->params.width, iblur);
+		font__blur(stash->scratch, bdst, gw,gh, stash->params.width, rblur);
 	}
 
-	stash->dirtyRect[0] = font__mini(stash->dirtyRect[0], glyph->x0);
-	stash->dirtyRect[1] = font__mini(stash->dirtyRect[1], glyph->y0);
-	stash->dirtyRect[2] = font__maxi(stash->dirtyRect[2], glyph->x1);
-	stash->dirtyRect[3] = font__maxi(stash->dirtyRect[3], glyph->y1);
+	return glyph;
+}
+
+// Finds the font and glyph index of the code point, the result is cached for all sizes.
+static int font__resolveGlyph(FONTcontext* stash, FONTfont* font, unsigned int codepoint, FONTfont** renderFont)
+{
+	int i, g;
+	unsigned int h = font__hashint(codepoint) & (FONT_HASH_LUT_SIZE-1);
+	FONTcodepoint* cp;
+
+	i = font->codepointLut[h];
+	while (i != -1) {
+		cp = &font->codepoints[i];
+		if (cp->codepoint == codepoint) {
+			*renderFont = cp->font;
+			return cp->glyph;
+		}
+		i = cp->next;
+	}
+
+	*renderFont = font;
+	g = font__getGlyphIndex(font->face, codepoint);
+	// Try to find the glyph in fallback fonts.
+	if (g == 0) {
+		for (i = 0; i < font->nfallbacks; ++i) {
+			FONTfont* fallbackFont = stash->fonts[font->fallbacks[i]];
+			int fallbackIndex;
+			if (!font__faceLoaded(stash, fallbackFont->face)) continue;
+			fallbackIndex = font__getGlyphIndex(fallbackFont->face, codepoint);
+			if (fallbackIndex != 0) {
+				g = fallbackIndex;
+				*renderFont = fallbackFont;
+				break;
+			}
+		}
+		// It is possible that we did not find a fallback glyph.
+		// In that case the glyph index 'g' is 0, and the empty glyph of the font is used.
+	}
+
+	cp = font__allocCodepoint(font);
+	if (cp != NULL) {
+		cp->codepoint = codepoint;
+		cp->glyph = g;
+		cp->font = *renderFont;
+		cp->next = font->codepointLut[h];
+		font->codepointLut[h] = font->ncodepoints-1;
+	}
+	return g;
+}
+
+static FONTglyph* font__getGlyph(FONTcontext* stash, FONTfont* font, unsigned int codepoint,
+								 short isize, short iblur)
+{
+	int i, g;
+	unsigned int h;
+	FONTglyph* glyph;
+	FONTglyphRef* ref;
+	FONTfont* renderFont = font;
+
+	if (isize < 2) return NULL;
+	font__glyphSize(stash, &isize, &iblur);
+
+	// Find code point and size.
+	h = font__hashint(codepoint) & (FONT_HASH_LUT_SIZE-1);
+	i = font->refLut[h];
+	while (i != -1) {
+		ref = &font->refs[i];
+		if (ref->codepoint == codepoint && ref->size == isize && ref->blur == iblur)
+			return &ref->font->glyphs[ref->glyph];
+		i = ref->next;
+	}
+
+	g = font__resolveGlyph(stash, font, codepoint, &renderFont);
+
+	// The bitmap is stored in the font it is rendered from, shared by all code points and fonts that use it.
+	glyph = font__getGlyphBitmap(stash, renderFont, g, isize, iblur);
+	if (glyph == NULL) return NULL;
+
+	ref = font__allocGlyphRef(font);
+	if (ref == NULL) return glyph;
+	ref->codepoint = codepoint;
+	ref->size = isize;
+	ref->blur = iblur;
+	ref->font = renderFont;
+	ref->glyph = (int)(glyph - renderFont->glyphs);
+	ref->next = font->refLut[h];
+	font->refLut[h] = font->nrefs-1;
 
 	return glyph;
 }
 
+// Kerning is looked up from a direct mapped cache of glyph pairs, filled as pairs are used.
+static int font__getKern(FONTface* face, int glyph1, int glyph2)
+{
+	FONTkernPair* pair;
+	unsigned int key = ((unsigned int)glyph1 << 16) | ((unsigned int)glyph2 & 0xffff);
+
+	if (face->kernCache == NULL) {
+		face->kernCache = (FONTkernPair*)malloc(sizeof(FONTkernPair) * FONT_KERN_CACHE_SIZE);
+		if (face->kernCache == NULL)
+			return font__tt_getGlyphKernAdvance(&face->font, glyph1, glyph2);
+		memset(face->kernCache, 0xff, sizeof(FONTkernPair) * FONT_KERN_CACHE_SIZE);
+	}
+
+	pair = &face->kernCache[font__hashint(key) & (FONT_KERN_CACHE_SIZE-1)];
+	if (pair->key != key) {
+		pair->key = key;
+		pair->kern = font__tt_getGlyphKernAdvance(&face->font, glyph1, glyph2);
+	}
+	return pair->kern;
+}
+
 static void font__getQuad(FONTcontext* stash, FONTfont* font,
-						   int prevGlyphIndex, FONTglyph* glyph,
+						   int prevGlyphIndex, unsigned int prevCodepoint, unsigned int codepoint, FONTglyph* glyph, short isize,
 						   float scale, float spacing, float* x, float* y, FONTquad* q)
 {
-	float rx,ry,xoff,yoff,x0,y0,x1,y1;
+	float rx,ry,xoff,yoff,x0,y0,x1,y1,gs;
+	short xadv = glyph->xadv;
 
 	if (prevGlyphIndex != -1) {
-		float adv = font__tt_getGlyphKernAdvance(&font->font, prevGlyphIndex, glyph->index) * scale;
+		float adv = 0.0f;
+		if (font->face->hasKerning) {
+			unsigned int c0 = prevCodepoint - FONT_ASCII_KERN_FIRST;
+			unsigned int c1 = codepoint - FONT_ASCII_KERN_FIRST;
+			int kern = FONT_ASCII_KERN_NONE;
+			if (font->face->asciiKern != NULL && c0 < FONT_ASCII_KERN_COUNT && c1 < FONT_ASCII_KERN_COUNT)
+				kern = font->face->asciiKern[c0 * FONT_ASCII_KERN_COUNT + c1];
+			if (kern == FONT_ASCII_KERN_NONE)
+				kern = font__getKern(font->face, prevGlyphIndex, glyph->index);
+			adv = kern * scale;
+		}
 		*x += (int)(adv + spacing + 0.5f);
 	}
 
 	// Each glyph has 2px border to allow good interpolation,
 	// one pixel to prevent leaking, and one to allow good interpolation for rendering.
 	// Inset the texture region by one pixel for correct interpolation.
-	xoff = (short)(glyph->xoff+1);
-	yoff = (short)(glyph->yoff+1);
+	// Low resolution and distance field glyphs are scaled to the requested size.
+	gs = (float)(1 << glyph->shift);
+	if (glyph->size != isize) {
+		// Compute the advance like it would be for a glyph rasterized at the requested size.
+		float rscale = glyph->font == font ? scale : font__tt_getPixelHeightScale(&glyph->font->face->font, isize/10.0f);
+		xadv = (short)(rscale * glyph->advance * 10.0f);
+		gs *= (float)isize / (float)glyph->size;
+	}
+	xoff = (short)(glyph->xoff+1) * gs;
+	yoff = (short)(glyph->yoff+1) * gs;
 	x0 = (float)(glyph->x0+1);
 	y0 = (float)(glyph->y0+1);
 	x1 = (float)(glyph->x1-1);
@@ -1219,8 +3378,8 @@ static void font__getQuad(FONTcontext* stash, FONTfont* font,
 
 		q->x0 = rx;
 		q->y0 = ry;
-		q->x1 = rx + x1 - x0;
-		q->y1 = ry + y1 - y0;
+		q->x1 = rx + (x1 - x0) * gs;
+		q->y1 = ry + (y1 - y0) * gs;
 
 		q->s0 = x0 * stash->itw;
 		q->t0 = y0 * stash->ith;
@@ -1232,8 +3391,8 @@ static void font__getQuad(FONTcontext* stash, FONTfont* font,
 
 		q->x0 = rx;
 		q->y0 = ry;
-		q->x1 = rx + x1 - x0;
-		q->y1 = ry - y1 + y0;
+		q->x1 = rx + (x1 - x0) * gs;
+		q->y1 = ry - (y1 - y0) * gs;
 
 		q->s0 = x0 * stash->itw;
 		q->t0 = y0 * stash->ith;
@@ -1241,7 +3400,7 @@ static void font__getQuad(FONTcontext* stash, FONTfont* font,
 		q->t1 = y1 * stash->ith;
 	}
 
-	*x += (int)(glyph->xadv / 10.0f + 0.5f);
+	*x += (int)(xadv / 10.0f + 0.5f);
 }
 
 static void font__flush(FONTcontext* stash)
@@ -1279,40 +3438,137 @@ static float font__getVertAlign(FONTcontext* stash, FONTfont* font, int align, s
 {
 	if (stash->params.flags & FONT_ZERO_TOPLEFT) {
 		if (align & FONT_ALIGN_TOP) {
-			return font->ascender * (float)isize/10.0f;
+			return font->face->ascender * (float)isize/10.0f;
 		} else if (align & FONT_ALIGN_MIDDLE) {
-			return (font->ascender + font->descender) / 2.0f * (float)isize/10.0f;
+			return (font->face->ascender + font->face->descender) / 2.0f * (float)isize/10.0f;
 		} else if (align & FONT_ALIGN_BASELINE) {
 			return 0.0f;
 		} else if (align & FONT_ALIGN_BOTTOM) {
-			return font->descender * (float)isize/10.0f;
+			return font->face->descender * (float)isize/10.0f;
 		}
 	} else {
 		if (align & FONT_ALIGN_TOP) {
-			return -font->ascender * (float)isize/10.0f;
+			return -font->face->ascender * (float)isize/10.0f;
 		} else if (align & FONT_ALIGN_MIDDLE) {
-			return -(font->ascender + font->descender) / 2.0f * (float)isize/10.0f;
+			return -(font->face->ascender + font->face->descender) / 2.0f * (float)isize/10.0f;
 		} else if (align & FONT_ALIGN_BASELINE) {
 			return 0.0f;
 		} else if (align & FONT_ALIGN_BOTTOM) {
-			return -font->descender * (float)isize/10.0f;
+			return -font->face->descender * (float)isize/10.0f;
 		}
 	}
 	return 0.0;
 }
 
-FONT_DEF float fontDrawText(FONTcontext* stash,
-				   float x, float y,
-				   const char* str, const char* end)
+static void font__setEffect(FONTcontext* stash, const FONTeffect* effect)
+{
+	if (memcmp(&stash->effect, effect, sizeof(FONTeffect)) == 0)
+		return;
+	// Draw the pending vertices with the previous effect.
+	font__flush(stash);
+	stash->effect = *effect;
+	if (stash->params.renderEffect != NULL)
+		stash->params.renderEffect(stash->params.userPtr, &stash->effect);
+}
+
+static void font__drawQuad(FONTcontext* stash, const FONTquad* q, unsigned int color)
+{
+	if (stash->nverts+6 > FONT_VERTEX_COUNT)
+		font__flush(stash);
+
+	font__vertex(stash, q->x0, q->y0, q->s0, q->t0, color);
+	font__vertex(stash, q->x1, q->y1, q->s1, q->t1, color);
+	font__vertex(stash, q->x1, q->y0, q->s1, q->t0, color);
+
+	font__vertex(stash, q->x0, q->y0, q->s0, q->t0, color);
+	font__vertex(stash, q->x0, q->y1, q->s0, q->t1, color);
+	font__vertex(stash, q->x1, q->y1, q->s1, q->t1, color);
+}
+
+static void font__addQuadBounds(FONTcontext* stash, const FONTquad* q, float* minx, float* miny, float* maxx, float* maxy)
+{
+	if (q->x0 < *minx) *minx = q->x0;
+	if (q->x1 > *maxx) *maxx = q->x1;
+	if (stash->params.flags & FONT_ZERO_TOPLEFT) {
+		if (q->y0 < *miny) *miny = q->y0;
+		if (q->y1 > *maxy) *maxy = q->y1;
+	} else {
+		if (q->y1 < *miny) *miny = q->y1;
+		if (q->y0 > *maxy) *maxy = q->y0;
+	}
+}
+
+// Converts a y offset or advance of a pre-shaped glyph to the y axis of the stash.
+static float font__glyphPosY(FONTcontext* stash, float dy)
+{
+	return (stash->params.flags & FONT_ZERO_BOTTOMLEFT) ? -dy : dy;
+}
+
+// Returns the glyph of a pre-shaped run and its quad at the pen position.
+static FONTglyph* font__getGlyphPosQuad(FONTcontext* stash, FONTfont* font, const FONTglyphPos* pos,
+										 short isize, short iblur, float scale, float x, float y, FONTquad* q)
+{
+	FONTglyph* glyph;
+	short gsize = isize, gblur = iblur;
+
+	if (isize < 2) return NULL;
+	font__glyphSize(stash, &gsize, &gblur);
+	glyph = font__getGlyphBitmap(stash, font, (int)pos->index, gsize, gblur);
+	if (glyph != NULL) {
+		x += pos->xoffset;
+		y += font__glyphPosY(stash, pos->yoffset);
+		font__getQuad(stash, font, -1, 0, 0, glyph, isize, scale, 0.0f, &x, &y, q);
+	}
+	return glyph;
+}
+
+static float font__drawGlyphs(FONTcontext* stash, FONTfont* font, float x, float y,
+							  int encoding, const char* str, const char* end, short isize, short iblur,
+							  float scale, float spacing, unsigned int color)
 {
-	FONTstate* state = font__getState(stash);
 	unsigned int codepoint;
 	unsigned int utf8state = 0;
+	int ascii = 0;
 	FONTglyph* glyph = NULL;
 	FONTquad q;
 	int prevGlyphIndex = -1;
+	unsigned int prevCodepoint = 0;
+
+	if (encoding == FONT_ENCODING_GLYPHS) {
+		const FONTglyphPos* pos;
+		for (pos = (const FONTglyphPos*)str; pos != (const FONTglyphPos*)end; pos++) {
+			if (font__getGlyphPosQuad(stash, font, pos, isize, iblur, scale, x, y, &q) != NULL)
+				font__drawQuad(stash, &q, color);
+			x += pos->xadvance;
+			y += font__glyphPosY(stash, pos->yadvance);
+		}
+		return x;
+	}
+
+	while (font__nextCodepoint(encoding, &str, end, &utf8state, &ascii, &codepoint)) {
+		glyph = font__getGlyph(stash, font, codepoint, isize, iblur);
+		if (glyph != NULL) {
+			font__getQuad(stash, font, prevGlyphIndex, prevCodepoint, codepoint, glyph, isize, scale, spacing, &x, &y, &q);
+			font__drawQuad(stash, &q, color);
+		}
+		prevGlyphIndex = glyph != NULL ? glyph->index : -1;
+		prevCodepoint = codepoint;
+	}
+
+	return x;
+}
+
+static float font__textBounds(FONTcontext* stash, float x, float y,
+							  int encoding, const char* str, const char* end, float* bounds);
+
+static float font__drawText(FONTcontext* stash, float x, float y,
+							int encoding, const char* str, const char* end)
+{
+	FONTstate* state = font__getState(stash);
 	short isize = (short)(state->size*10.0f);
 	short iblur = (short)state->blur;
+	int sdf = (stash->params.flags & FONT_SDF) != 0;
+	FONTeffect effect;
 	float scale;
 	FONTfont* font;
 	float width;
@@ -1320,53 +3576,249 @@ FONT_DEF float fontDrawText(FONTcontext* stash,
 	if (stash == NULL) return x;
 	if (state->font < 0 || state->font >= stash->nfonts) return x;
 	font = stash->fonts[state->font];
-	if (font->data == NULL) return x;
+	if (!font__faceLoaded(stash, font->face)) return x;
 
-	scale = font__tt_getPixelHeightScale(&font->font, (float)isize/10.0f);
-
-	if (end == NULL)
-		end = str + strlen(str);
+	scale = font__tt_getPixelHeightScale(&font->face->font, (float)isize/10.0f);
 
 	// Align horizontally
 	if (state->align & FONT_ALIGN_LEFT) {
 		// empty
 	} else if (state->align & FONT_ALIGN_RIGHT) {
-		width = fontTextBounds(stash, x,y, str, end, NULL);
+		width = font__textBounds(stash, x,y, encoding, str, end, NULL);
 		x -= width;
 	} else if (state->align & FONT_ALIGN_CENTER) {
-		width = fontTextBounds(stash, x,y, str, end, NULL);
+		width = font__textBounds(stash, x,y, encoding, str, end, NULL);
 		x -= width * 0.5f;
 	}
 	// Align vertically.
 	y += font__getVertAlign(stash, font, state->align, isize);
 
-	for (; str != end; ++str) {
-		if (font__decutf8(&utf8state, &codepoint, *(const unsigned char*)str))
-			continue;
-		glyph = font__getGlyph(stash, font, codepoint, isize, iblur);
+	// Shadow pass, grown by the outline so that it is the shadow of the outlined text.
+	if (state->shadowX != 0 || state->shadowY != 0 || state->shadowSoftness > 0) {
+		memset(&effect, 0, sizeof(effect));
+		if (sdf) {
+			effect.dilate = state->outlineWidth;
+			effect.softness = state->shadowSoftness;
+		}
+		font__setEffect(stash, &effect);
+		font__drawGlyphs(stash, font, x + state->shadowX, y + state->shadowY, encoding, str, end,
+						 isize, sdf ? 0 : (short)state->shadowSoftness, scale, state->spacing, state->shadowColor);
+	}
+
+	// Distance field text is blurred by the renderer.
+	memset(&effect, 0, sizeof(effect));
+	if (sdf) {
+		effect.softness = state->blur;
+		effect.outlineWidth = state->outlineWidth;
+		effect.outlineColor = state->outlineColor;
+	}
+	font__setEffect(stash, &effect);
+	x = font__drawGlyphs(stash, font, x, y, encoding, str, end, isize, iblur, scale, state->spacing, state->color);
+	font__flush(stash);
+
+	return x;
+}
+
+FONT_DEF float fontDrawText(FONTcontext* stash,
+				   float x, float y,
+				   const char* str, const char* end)
+{
+	if (end == NULL)
+		end = str + strlen(str);
+	return font__drawText(stash, x, y, FONT_ENCODING_UTF8, str, end);
+}
+
+FONT_DEF float fontDrawText16(FONTcontext* stash,
+				   float x, float y,
+				   const unsigned short* str, const unsigned short* end)
+{
+	if (end == NULL)
+		end = font__strend16(str);
+	return font__drawText(stash, x, y, FONT_ENCODING_UTF16, (const char*)str, (const char*)end);
+}
+
+FONT_DEF float fontDrawText32(FONTcontext* stash,
+				   float x, float y,
+				   const unsigned int* str, const unsigned int* end)
+{
+	if (end == NULL)
+		end = font__strend32(str);
+	return font__drawText(stash, x, y, FONT_ENCODING_UTF32, (const char*)str, (const char*)end);
+}
+
+#ifdef FONT_TT_WORKERS
+// A glyph rasterized by a worker, the bitmap includes the padding.
+struct FONTprefetchJob {
+	FONTfont* font;
+	int g;
+	short isize, iblur;
+	int shift, rblur, pad;
+	int advance, x0, y0, x1, y1;
+	unsigned char* data;
+};
+typedef struct FONTprefetchJob FONTprefetchJob;
+
+struct FONTprefetch {
+	FONTcontext* stash;
+	FONTprefetchJob* jobs;
+};
+typedef struct FONTprefetch FONTprefetch;
+
+static void font__prefetchJob(void* arg, int index, int worker)
+{
+	FONTprefetch* prefetch = (FONTprefetch*)arg;
+	FONTprefetchJob* job = &prefetch->jobs[index];
+	FONTworker* w = &prefetch->stash->workers[worker];
+	// Only this worker uses its font, so it can be opened here.
+	FONTttFontImpl* tt = &job->font->workerFonts[worker];
+	float size = job->isize/10.0f, scale;
+	int lsb, gw, gh;
+
+	if (!font__tt_isLoaded(tt) && !font__tt_loadWorkerFont(&w->tt, tt, job->font->face->data, job->font->face->dataSize))
+		return;
+	scale = font__tt_getPixelHeightScale(tt, size) / (1 << job->shift);
+	if (!font__tt_buildGlyphBitmap(tt, job->g, size / (1 << job->shift), scale, &job->advance, &lsb, &job->x0, &job->y0, &job->x1, &job->y1))
+		return;
+
+	gw = job->x1-job->x0 + job->pad*2;
+	gh = job->y1-job->y0 + job->pad*2;
+	job->data = (unsigned char*)calloc(gw * gh, 1);
+	if (job->data == NULL) return;
+	font__tt_renderGlyphBitmap(tt, &job->data[job->pad + job->pad*gw], gw-job->pad*2, gh-job->pad*2, gw, scale,scale, job->g);
+	if (job->rblur > 0)
+		font__blur(w->scratch, job->data, gw,gh, gw, job->rblur);
+}
+
+// Rasterizes the missing glyphs on the workers and adds them to the atlas in the order they are used.
+static void font__prefetchParallel(FONTcontext* stash, FONTfont* font, const char* str, const char* end,
+								   short isize, const short* iblurs, int npasses)
+{
+	FONTprefetch prefetch;
+	FONTprefetchJob* jobs = NULL;
+	FONTprefetchJob* job;
+	FONTfont* renderFont;
+	FONTglyph* glyph;
+	unsigned int codepoint, utf8state;
+	int i, g, y, pass, ascii, njobs = 0, cjobs = 0;
+	const char* s;
+
+	for (pass = 0; pass < npasses; pass++) {
+		utf8state = 0;
+		ascii = 0;
+		s = str;
+		while (font__nextCodepoint(FONT_ENCODING_UTF8, &s, end, &utf8state, &ascii, &codepoint)) {
+			short gsize = isize, gblur = iblurs[pass];
+			font__glyphSize(stash, &gsize, &gblur);
+			g = font__resolveGlyph(stash, font, codepoint, &renderFont);
+			if (font__findGlyph(renderFont, g, gsize, gblur) != -1) continue;
+			for (i = 0; i < njobs; i++) {
+				if (jobs[i].font == renderFont && jobs[i].g == g && jobs[i].isize == gsize && jobs[i].iblur == gblur)
+					break;
+			}
+			if (i < njobs) continue;
+
+			if (renderFont->workerFonts == NULL) {
+				renderFont->workerFonts = (FONTttFontImpl*)calloc(stash->nworkers, sizeof(FONTttFontImpl));
+				if (renderFont->workerFonts == NULL) continue;
+				renderFont->nworkerFonts = stash->nworkers;
+			}
+			if (njobs+1 > cjobs) {
+				FONTprefetchJob* j;
+				cjobs = cjobs == 0 ? 32 : cjobs * 2;
+				j = (FONTprefetchJob*)realloc(jobs, sizeof(FONTprefetchJob) * cjobs);
+				if (j == NULL) goto error;
+				jobs = j;
+			}
+			job = &jobs[njobs++];
+			memset(job, 0, sizeof(FONTprefetchJob));
+			job->font = renderFont;
+			job->g = g;
+			job->isize = gsize;
+			job->iblur = gblur;
+			job->pad = font__glyphPadding(stash, gblur, &job->shift, &job->rblur);
+		}
+	}
+	if (njobs == 0) return;
+
+	prefetch.stash = stash;
+	prefetch.jobs = jobs;
+	stash->params.runParallel(stash->params.userPtr, font__prefetchJob, &prefetch, njobs);
+
+	for (i = 0; i < njobs; i++) {
+		int gw, gh;
+		float scale;
+		job = &jobs[i];
+		if (job->data == NULL) continue;
+		gw = job->x1-job->x0 + job->pad*2;
+		gh = job->y1-job->y0 + job->pad*2;
+		scale = font__tt_getPixelHeightScale(&job->font->face->font, job->isize/10.0f);
+		glyph = font__addGlyph(stash, job->font, job->g, job->isize, job->iblur, job->shift, job->pad,
+							   (short)(scale * job->advance * 10.0f), job->advance, job->x0, job->y0, job->x1, job->y1);
 		if (glyph != NULL) {
-			font__getQuad(stash, font, prevGlyphIndex, glyph, scale, state->spacing, &x, &y, &q);
+			unsigned char* dst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
+			for (y = 0; y < gh; y++)
+				memcpy(&dst[y * stash->params.width], &job->data[y * gw], gw);
+		}
+	}
+
+error:
+	for (i = 0; i < njobs; i++)
+		if (jobs[i].data) free(jobs[i].data);
+	if (jobs) free(jobs);
+}
+#endif
 
-			if (stash->nverts+6 > FONT_VERTEX_COUNT)
-				font__flush(stash);
+FONT_DEF int fontPrefetchText(FONTcontext* stash, const char* str, const char* end)
+{
+	FONTstate* state;
+	FONTfont* font;
+	short isize, iblurs[2];
+	int i, pass, npasses = 0, nglyphs = 0, sdf;
+	unsigned int codepoint, utf8state;
+	int ascii;
+	const char* s;
 
-			font__vertex(stash, q.x0, q.y0, q.s0, q.t0, state->color);
-			font__vertex(stash, q.x1, q.y1, q.s1, q.t1, state->color);
-			font__vertex(stash, q.x1, q.y0, q.s1, q.t0, state->color);
+	if (stash == NULL) return 0;
+	state = font__getState(stash);
+	if (state->font < 0 || state->font >= stash->nfonts) return 0;
+	font = stash->fonts[state->font];
+	if (!font__faceLoaded(stash, font->face)) return 0;
+	if (end == NULL)
+		end = str + strlen(str);
 
-			font__vertex(stash, q.x0, q.y0, q.s0, q.t0, state->color);
-			font__vertex(stash, q.x0, q.y1, q.s0, q.t1, state->color);
-			font__vertex(stash, q.x1, q.y1, q.s1, q.t1, state->color);
+	// Same glyphs as font__drawText(), the shadow pass first.
+	isize = (short)(state->size*10.0f);
+	if (isize < 2) return 0;
+	sdf = (stash->params.flags & FONT_SDF) != 0;
+	if (state->shadowX != 0 || state->shadowY != 0 || state->shadowSoftness > 0)
+		iblurs[npasses++] = sdf ? 0 : (short)state->shadowSoftness;
+	iblurs[npasses++] = (short)state->blur;
+
+	for (i = 0; i < stash->nfonts; i++)
+		nglyphs -= stash->fonts[i]->nglyphs;
+
+#ifdef FONT_TT_WORKERS
+	if (!sdf && stash->params.workers > 1 && stash->params.runParallel != NULL && font__initWorkers(stash)) {
+		font__prefetchParallel(stash, font, str, end, isize, iblurs, npasses);
+	} else
+#endif
+	{
+		for (pass = 0; pass < npasses; pass++) {
+			utf8state = 0;
+			ascii = 0;
+			s = str;
+			while (font__nextCodepoint(FONT_ENCODING_UTF8, &s, end, &utf8state, &ascii, &codepoint))
+				font__getGlyph(stash, font, codepoint, isize, iblurs[pass]);
 		}
-		prevGlyphIndex = glyph != NULL ? glyph->index : -1;
 	}
-	font__flush(stash);
 
-	return x;
+	for (i = 0; i < stash->nfonts; i++)
+		nglyphs += stash->fonts[i]->nglyphs;
+	return nglyphs;
 }
 
-FONT_DEF int fontTextIterInit(FONTcontext* stash, FONTtextIter* iter,
-					 float x, float y, const char* str, const char* end)
+static int font__textIterInit(FONTcontext* stash, FONTtextIter* iter, float x, float y,
+							  int encoding, const char* str, const char* end)
 {
 	FONTstate* state = font__getState(stash);
 	float width;
@@ -1376,28 +3828,25 @@ FONT_DEF int fontTextIterInit(FONTcontext* stash, FONTtextIter* iter,
 	if (stash == NULL) return 0;
 	if (state->font < 0 || state->font >= stash->nfonts) return 0;
 	iter->font = stash->fonts[state->font];
-	if (iter->font->data == NULL) return 0;
+	if (!font__faceLoaded(stash, iter->font->face)) return 0;
 
 	iter->isize = (short)(state->size*10.0f);
 	iter->iblur = (short)state->blur;
-	iter->scale = font__tt_getPixelHeightScale(&iter->font->font, (float)iter->isize/10.0f);
+	iter->scale = font__tt_getPixelHeightScale(&iter->font->face->font, (float)iter->isize/10.0f);
 
 	// Align horizontally
 	if (state->align & FONT_ALIGN_LEFT) {
 		// empty
 	} else if (state->align & FONT_ALIGN_RIGHT) {
-		width = fontTextBounds(stash, x,y, str, end, NULL);
+		width = font__textBounds(stash, x,y, encoding, str, end, NULL);
 		x -= width;
 	} else if (state->align & FONT_ALIGN_CENTER) {
-		width = fontTextBounds(stash, x,y, str, end, NULL);
+		width = font__textBounds(stash, x,y, encoding, str, end, NULL);
 		x -= width * 0.5f;
 	}
 	// Align vertically.
 	y += font__getVertAlign(stash, iter->font, state->align, iter->isize);
 
-	if (end == NULL)
-		end = str + strlen(str);
-
 	iter->x = iter->nextx = x;
 	iter->y = iter->nexty = y;
 	iter->spacing = state->spacing;
@@ -1406,10 +3855,37 @@ FONT_DEF int fontTextIterInit(FONTcontext* stash, FONTtextIter* iter,
 	iter->end = end;
 	iter->codepoint = 0;
 	iter->prevGlyphIndex = -1;
+	iter->prevCodepoint = 0;
+	iter->ascii = 0;
+	iter->encoding = encoding;
 
 	return 1;
 }
 
+FONT_DEF int fontTextIterInit(FONTcontext* stash, FONTtextIter* iter,
+					 float x, float y, const char* str, const char* end)
+{
+	if (end == NULL)
+		end = str + strlen(str);
+	return font__textIterInit(stash, iter, x, y, FONT_ENCODING_UTF8, str, end);
+}
+
+FONT_DEF int fontTextIterInit16(FONTcontext* stash, FONTtextIter* iter,
+					 float x, float y, const unsigned short* str, const unsigned short* end)
+{
+	if (end == NULL)
+		end = font__strend16(str);
+	return font__textIterInit(stash, iter, x, y, FONT_ENCODING_UTF16, (const char*)str, (const char*)end);
+}
+
+FONT_DEF int fontTextIterInit32(FONTcontext* stash, FONTtextIter* iter,
+					 float x, float y, const unsigned int* str, const unsigned int* end)
+{
+	if (end == NULL)
+		end = font__strend32(str);
+	return font__textIterInit(stash, iter, x, y, FONT_ENCODING_UTF32, (const char*)str, (const char*)end);
+}
+
 FONT_DEF int fontTextIterNext(FONTcontext* stash, FONTtextIter* iter, FONTquad* quad)
 {
 	FONTglyph* glyph = NULL;
@@ -1419,18 +3895,15 @@ FONT_DEF int fontTextIterNext(FONTcontext* stash, FONTtextIter* iter, FONTquad*
 	if (str == iter->end)
 		return 0;
 
-	for (; str != iter->end; str++) {
-		if (font__decutf8(&iter->utf8state, &iter->codepoint, *(const unsigned char*)str))
-			continue;
-		str++;
+	if (font__nextCodepoint(iter->encoding, &str, iter->end, &iter->utf8state, &iter->ascii, &iter->codepoint)) {
 		// Get glyph and quad
 		iter->x = iter->nextx;
 		iter->y = iter->nexty;
 		glyph = font__getGlyph(stash, iter->font, iter->codepoint, iter->isize, iter->iblur);
 		if (glyph != NULL)
-			font__getQuad(stash, iter->font, iter->prevGlyphIndex, glyph, iter->scale, iter->spacing, &iter->nextx, &iter->nexty, quad);
+			font__getQuad(stash, iter->font, iter->prevGlyphIndex, iter->prevCodepoint, iter->codepoint, glyph, iter->isize, iter->scale, iter->spacing, &iter->nextx, &iter->nexty, quad);
 		iter->prevGlyphIndex = glyph != NULL ? glyph->index : -1;
-		break;
+		iter->prevCodepoint = iter->codepoint;
 	}
 	iter->next = str;
 
@@ -1444,6 +3917,10 @@ FONT_DEF void fontDrawDebug(FONTcontext* stash, float x, float y)
 	int h = stash->params.height;
 	float u = w == 0 ? 0 : (1.0f / w);
 	float v = h == 0 ? 0 : (1.0f / h);
+	FONTeffect effect;
+
+	memset(&effect, 0, sizeof(effect));
+	font__setEffect(stash, &effect);
 
 	if (stash->nverts+6+6 > FONT_VERTEX_COUNT)
 		font__flush(stash);
@@ -1485,17 +3962,17 @@ FONT_DEF void fontDrawDebug(FONTcontext* stash, float x, float y)
 	font__flush(stash);
 }
 
-FONT_DEF float fontTextBounds(FONTcontext* stash,
-					 float x, float y, 
-					 const char* str, const char* end,
-					 float* bounds)
+static float font__textBounds(FONTcontext* stash, float x, float y,
+							  int encoding, const char* str, const char* end, float* bounds)
 {
 	FONTstate* state = font__getState(stash);
 	unsigned int codepoint;
 	unsigned int utf8state = 0;
+	int ascii = 0;
 	FONTquad q;
 	FONTglyph* glyph = NULL;
 	int prevGlyphIndex = -1;
+	unsigned int prevCodepoint = 0;
 	short isize = (short)(state->size*10.0f);
 	short iblur = (short)state->blur;
 	float scale;
@@ -1506,9 +3983,9 @@ FONT_DEF float fontTextBounds(FONTcontext* stash,
 	if (stash == NULL) return 0;
 	if (state->font < 0 || state->font >= stash->nfonts) return 0;
 	font = stash->fonts[state->font];
-	if (font->data == NULL) return 0;
+	if (!font__faceLoaded(stash, font->face)) return 0;
 
-	scale = font__tt_getPixelHeightScale(&font->font, (float)isize/10.0f);
+	scale = font__tt_getPixelHeightScale(&font->face->font, (float)isize/10.0f);
 
 	// Align vertically.
 	y += font__getVertAlign(stash, font, state->align, isize);
@@ -1517,26 +3994,24 @@ FONT_DEF float fontTextBounds(FONTcontext* stash,
 	miny = maxy = y;
 	startx = x;
 
-	if (end == NULL)
-		end = str + strlen(str);
-
-	for (; str != end; ++str) {
-		if (font__decutf8(&utf8state, &codepoint, *(const unsigned char*)str))
-			continue;
-		glyph = font__getGlyph(stash, font, codepoint, isize, iblur);
-		if (glyph != NULL) {
-			font__getQuad(stash, font, prevGlyphIndex, glyph, scale, state->spacing, &x, &y, &q);
-			if (q.x0 < minx) minx = q.x0;
-			if (q.x1 > maxx) maxx = q.x1;
-			if (stash->params.flags & FONT_ZERO_TOPLEFT) {
-				if (q.y0 < miny) miny = q.y0;
-				if (q.y1 > maxy) maxy = q.y1;
-			} else {
-				if (q.y1 < miny) miny = q.y1;
-				if (q.y0 > maxy) maxy = q.y0;
+	if (encoding == FONT_ENCODING_GLYPHS) {
+		const FONTglyphPos* pos;
+		for (pos = (const FONTglyphPos*)str; pos != (const FONTglyphPos*)end; pos++) {
+			if (font__getGlyphPosQuad(stash, font, pos, isize, iblur, scale, x, y, &q) != NULL)
+				font__addQuadBounds(stash, &q, &minx, &miny, &maxx, &maxy);
+			x += pos->xadvance;
+			y += font__glyphPosY(stash, pos->yadvance);
+		}
+	} else {
+		while (font__nextCodepoint(encoding, &str, end, &utf8state, &ascii, &codepoint)) {
+			glyph = font__getGlyph(stash, font, codepoint, isize, iblur);
+			if (glyph != NULL) {
+				font__getQuad(stash, font, prevGlyphIndex, prevCodepoint, codepoint, glyph, isize, scale, state->spacing, &x, &y, &q);
+				font__addQuadBounds(stash, &q, &minx, &miny, &maxx, &maxy);
 			}
+			prevGlyphIndex = glyph != NULL ? glyph->index : -1;
+			prevCodepoint = codepoint;
 		}
-		prevGlyphIndex = glyph != NULL ? glyph->index : -1;
 	}
 
 	advance = x - startx;
@@ -1562,6 +4037,51 @@ FONT_DEF float fontTextBounds(FONTcontext* stash,
 	return advance;
 }
 
+FONT_DEF float fontTextBounds(FONTcontext* stash,
+					 float x, float y, 
+					 const char* str, const char* end,
+					 float* bounds)
+{
+	if (end == NULL)
+		end = str + strlen(str);
+	return font__textBounds(stash, x, y, FONT_ENCODING_UTF8, str, end, bounds);
+}
+
+FONT_DEF float fontTextBounds16(FONTcontext* stash,
+					 float x, float y,
+					 const unsigned short* str, const unsigned short* end,
+					 float* bounds)
+{
+	if (end == NULL)
+		end = font__strend16(str);
+	return font__textBounds(stash, x, y, FONT_ENCODING_UTF16, (const char*)str, (const char*)end, bounds);
+}
+
+FONT_DEF float fontTextBounds32(FONTcontext* stash,
+					 float x, float y,
+					 const unsigned int* str, const unsigned int* end,
+					 float* bounds)
+{
+	if (end == NULL)
+		end = font__strend32(str);
+	return font__textBounds(stash, x, y, FONT_ENCODING_UTF32, (const char*)str, (const char*)end, bounds);
+}
+
+FONT_DEF float fontDrawGlyphs(FONTcontext* stash,
+				   float x, float y,
+				   const FONTglyphPos* glyphs, int nglyphs)
+{
+	return font__drawText(stash, x, y, FONT_ENCODING_GLYPHS, (const char*)glyphs, (const char*)(glyphs + nglyphs));
+}
+
+FONT_DEF float fontGlyphBounds(FONTcontext* stash,
+					 float x, float y,
+					 const FONTglyphPos* glyphs, int nglyphs,
+					 float* bounds)
+{
+	return font__textBounds(stash, x, y, FONT_ENCODING_GLYPHS, (const char*)glyphs, (const char*)(glyphs + nglyphs), bounds);
+}
+
 FONT_DEF void fontVertMetrics(FONTcontext* stash,
 					 float* ascender, float* descender, float* lineh)
 {
@@ -1573,14 +4093,14 @@ FONT_DEF void fontVertMetrics(FONTcontext* stash,
 	if (state->font < 0 || state->font >= stash->nfonts) return;
 	font = stash->fonts[state->font];
 	isize = (short)(state->size*10.0f);
-	if (font->data == NULL) return;
+	if (!font__faceLoaded(stash, font->face)) return;
 
 	if (ascender)
-		*ascender = font->ascender*isize/10.0f;
+		*ascender = font->face->ascender*isize/10.0f;
 	if (descender)
-		*descender = font->descender*isize/10.0f;
+		*descender = font->face->descender*isize/10.0f;
 	if (lineh)
-		*lineh = font->lineh*isize/10.0f;
+		*lineh = font->face->lineh*isize/10.0f;
 }
 
 FONT_DEF void fontLineBounds(FONTcontext* stash, float y, float* miny, float* maxy)
@@ -1593,16 +4113,16 @@ FONT_DEF void fontLineBounds(FONTcontext* stash, float y, float* miny, float* ma
 	if (state->font < 0 || state->font >= stash->nfonts) return;
 	font = stash->fonts[state->font];
 	isize = (short)(state->size*10.0f);
-	if (font->data == NULL) return;
+	if (!font__faceLoaded(stash, font->face)) return;
 
 	y += font__getVertAlign(stash, font, state->align, isize);
 
 	if (stash->params.flags & FONT_ZERO_TOPLEFT) {
-		*miny = y - font->ascender * (float)isize/10.0f;
-		*maxy = *miny + font->lineh*isize/10.0f;
+		*miny = y - font->face->ascender * (float)isize/10.0f;
+		*maxy = *miny + font->face->lineh*isize/10.0f;
 	} else {
-		*maxy = y + font->descender * (float)isize/10.0f;
-		*miny = *maxy - font->lineh*isize/10.0f;
+		*maxy = y + font->face->descender * (float)isize/10.0f;
+		*miny = *maxy - font->face->lineh*isize/10.0f;
 	}
 }
 
@@ -1632,6 +4152,27 @@ FONT_DEF int fontValidateTexture(FONTcontext* stash, int* dirty)
 	return 0;
 }
 
+FONT_DEF FONTregistry* fontCreateRegistry(void)
+{
+	FONTregistry* registry = (FONTregistry*)malloc(sizeof(FONTregistry));
+	if (registry == NULL) return NULL;
+	registry->faces = NULL;
+	registry->refs = 1;
+	return registry;
+}
+
+static void font__releaseRegistry(FONTregistry* registry)
+{
+	// The faces have been released by the fonts of the contexts.
+	if (registry != NULL && --registry->refs == 0)
+		free(registry);
+}
+
+FONT_DEF void fontDeleteRegistry(FONTregistry* registry)
+{
+	font__releaseRegistry(registry);
+}
+
 FONT_DEF void fontDeleteInternal(FONTcontext* stash)
 {
 	int i;
@@ -1642,11 +4183,16 @@ FONT_DEF void fontDeleteInternal(FONTcontext* stash)
 
 	for (i = 0; i < stash->nfonts; ++i)
 		font__freeFont(stash->fonts[i]);
+#ifdef FONT_TT_WORKERS
+	font__freeWorkers(stash);
+#endif
+	font__releaseRegistry(stash->params.registry);
 
 	if (stash->atlas) font__deleteAtlas(stash->atlas);
 	if (stash->fonts) free(stash->fonts);
 	if (stash->texData) free(stash->texData);
 	if (stash->scratch) free(stash->scratch);
+	if (stash->sizeBuckets) free(stash->sizeBuckets);
 	free(stash);
 }
 
@@ -1752,8 +4298,11 @@ FONT_DEF int fontResetAtlas(FONTcontext* stash, int width, int height)
 	for (i = 0; i < stash->nfonts; i++) {
 		FONTfont* font = stash->fonts[i];
 		font->nglyphs = 0;
-		for (j = 0; j < FONT_HASH_LUT_SIZE; j++)
+		font->nrefs = 0;
+		for (j = 0; j < FONT_HASH_LUT_SIZE; j++) {
 			font->lut[j] = -1;
+			font->refLut[j] = -1;
+		}
 	}
 
 	stash->params.width = width;
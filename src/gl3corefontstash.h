@@ -27,6 +27,9 @@ FONT_DEF void glfontDelete(FONTcontext* ctx);
 
 FONT_DEF unsigned int glfontRGBA(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 
+// Sets the column-major model-view-projection matrix used by the built-in distance field shader (FONT_SDF).
+FONT_DEF void glfontSetMatrix(FONTcontext* ctx, const float* mvp);
+
 #ifdef __cplusplus
 }
 #endif
@@ -54,9 +57,116 @@ struct GLFONTcontext {
 	GLuint vertexBuffer;
 	GLuint tcoordBuffer;
 	GLuint colorBuffer;
+	int sdf;
+	GLuint program;
+	GLint mvpLoc;
+	GLint texLoc;
+	GLint effectLoc;
+	GLint outlineColorLoc;
+	float mvp[16];
+	FONTeffect effect;
 };
 typedef struct GLFONTcontext GLFONTcontext;
 
+// Distance field shader, used when the context is created with FONT_SDF.
+// The color attribute is passed as unnormalized bytes.
+static const char* glfont__sdfVertexShader =
+	"#version 150\n"
+	"uniform mat4 mvp;\n"
+	"in vec2 vertex;\n"
+	"in vec2 tcoord;\n"
+	"in vec4 color;\n"
+	"out vec2 ftcoord;\n"
+	"out vec4 fcolor;\n"
+	"void main() {\n"
+	"	ftcoord = tcoord;\n"
+	"	fcolor = color / 255.0;\n"
+	"	gl_Position = mvp * vec4(vertex, 0.0, 1.0);\n"
+	"}\n";
+
+// The distance is converted to screen pixels using the texel to pixel ratio of the quad,
+// effect is (dilate, softness, outline width) in pixels, see FONTeffect.
+static const char* glfont__sdfFragmentShader =
+	"#version 150\n"
+	"uniform sampler2D tex;\n"
+	"uniform float onedge;\n"
+	"uniform float distScale;\n"
+	"uniform vec3 effect;\n"
+	"uniform vec4 outlineColor;\n"
+	"in vec2 ftcoord;\n"
+	"in vec4 fcolor;\n"
+	"out vec4 outColor;\n"
+	"void main() {\n"
+	"	vec2 tpp = fwidth(ftcoord) * vec2(textureSize(tex, 0));\n"
+	"	float d = (texture(tex, ftcoord).a - onedge) * distScale / max(0.5 * (tpp.x + tpp.y), 1e-4) + effect.x;\n"
+	"	float w = 0.5 + 0.5 * effect.y;\n"
+	"	float fill = smoothstep(-w, w, d);\n"
+	"	vec4 color = fcolor;\n"
+	"	if (effect.z > 0.0) {\n"
+	"		color = mix(outlineColor, fcolor, fill);\n"
+	"		fill = smoothstep(-w, w, d + effect.z);\n"
+	"	}\n"
+	"	outColor = vec4(color.rgb, color.a * fill);\n"
+	"}\n";
+
+static GLuint glfont__compileShader(GLenum type, const char* source)
+{
+	GLint status = 0;
+	GLuint shader = glCreateShader(type);
+	if (shader == 0) return 0;
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE) {
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static int glfont__createProgram(GLFONTcontext* gl)
+{
+	GLint status = 0, program = 0;
+	GLuint vert, frag;
+
+	vert = glfont__compileShader(GL_VERTEX_SHADER, glfont__sdfVertexShader);
+	frag = glfont__compileShader(GL_FRAGMENT_SHADER, glfont__sdfFragmentShader);
+	if (vert == 0 || frag == 0) goto error;
+
+	gl->program = glCreateProgram();
+	if (gl->program == 0) goto error;
+	glAttachShader(gl->program, vert);
+	glAttachShader(gl->program, frag);
+	glBindAttribLocation(gl->program, GLFONT_VERTEX_ATTRIB, "vertex");
+	glBindAttribLocation(gl->program, GLFONT_TCOORD_ATTRIB, "tcoord");
+	glBindAttribLocation(gl->program, GLFONT_COLOR_ATTRIB, "color");
+	glLinkProgram(gl->program);
+	glDeleteShader(vert);
+	glDeleteShader(frag);
+	glGetProgramiv(gl->program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+		glDeleteProgram(gl->program);
+		gl->program = 0;
+		return 0;
+	}
+
+	gl->mvpLoc = glGetUniformLocation(gl->program, "mvp");
+	gl->texLoc = glGetUniformLocation(gl->program, "tex");
+	gl->effectLoc = glGetUniformLocation(gl->program, "effect");
+	gl->outlineColorLoc = glGetUniformLocation(gl->program, "outlineColor");
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	glUseProgram(gl->program);
+	glUniform1f(glGetUniformLocation(gl->program, "onedge"), FONT_SDF_ONEDGE / 255.0f);
+	glUniform1f(glGetUniformLocation(gl->program, "distScale"), 255.0f * FONT_SDF_PADDING / FONT_SDF_ONEDGE);
+	glUseProgram(program);
+	return 1;
+
+error:
+	if (vert != 0) glDeleteShader(vert);
+	if (frag != 0) glDeleteShader(frag);
+	return 0;
+}
+
 static int glfont__renderCreate(void* userPtr, int width, int height)
 {
 	GLFONTcontext* gl = (GLFONTcontext*)userPtr;
@@ -84,6 +194,8 @@ static int glfont__renderCreate(void* userPtr, int width, int height)
 	if (!gl->colorBuffer) glGenBuffers(1, &gl->colorBuffer);
 	if (!gl->colorBuffer) return 0;
 
+	if (gl->sdf && !gl->program && !glfont__createProgram(gl)) return 0;
+
 	gl->width = width;
 	gl->height = height;
 	glBindTexture(GL_TEXTURE_2D, gl->tex);
@@ -136,8 +248,22 @@ static void glfont__renderUpdate(void* userPtr, int* rect, const unsigned char*
 static void glfont__renderDraw(void* userPtr, const float* verts, const float* tcoords, const unsigned int* colors, int nverts)
 {
 	GLFONTcontext* gl = (GLFONTcontext*)userPtr;
+	GLint program = 0;
 	if (gl->tex == 0 || gl->vertexArray == 0) return;
 
+	if (gl->program != 0) {
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		glUseProgram(gl->program);
+		glUniformMatrix4fv(gl->mvpLoc, 1, GL_FALSE, gl->mvp);
+		glUniform1i(gl->texLoc, 0);
+		glUniform3f(gl->effectLoc, gl->effect.dilate, gl->effect.softness, gl->effect.outlineWidth);
+		glUniform4f(gl->outlineColorLoc,
+					(float)(gl->effect.outlineColor & 0xff) / 255.0f,
+					(float)((gl->effect.outlineColor >> 8) & 0xff) / 255.0f,
+					(float)((gl->effect.outlineColor >> 16) & 0xff) / 255.0f,
+					(float)((gl->effect.outlineColor >> 24) & 0xff) / 255.0f);
+	}
+
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, gl->tex);
 
@@ -165,6 +291,15 @@ static void glfont__renderDraw(void* userPtr, const float* verts, const float* t
 	glDisableVertexAttribArray(GLFONT_COLOR_ATTRIB);
 
 	glBindVertexArray(0);
+
+	if (gl->program != 0)
+		glUseProgram(program);
+}
+
+static void glfont__renderEffect(void* userPtr, const FONTeffect* effect)
+{
+	GLFONTcontext* gl = (GLFONTcontext*)userPtr;
+	gl->effect = *effect;
 }
 
 static void glfont__renderDelete(void* userPtr)
@@ -197,6 +332,11 @@ static void glfont__renderDelete(void* userPtr)
 		gl->vertexArray = 0;
 	}
 
+	if (gl->program != 0) {
+		glDeleteProgram(gl->program);
+		gl->program = 0;
+	}
+
 	free(gl);
 }
 
@@ -208,6 +348,8 @@ FONT_DEF FONTcontext* glfontCreate(int width, int height, int flags)
 	gl = (GLFONTcontext*)malloc(sizeof(GLFONTcontext));
 	if (gl == NULL) goto error;
 	memset(gl, 0, sizeof(GLFONTcontext));
+	gl->sdf = (flags & FONT_SDF) != 0;
+	gl->mvp[0] = gl->mvp[5] = gl->mvp[10] = gl->mvp[15] = 1.0f;
 
 	memset(&params, 0, sizeof(params));
 	params.width = width;
@@ -218,6 +360,7 @@ FONT_DEF FONTcontext* glfontCreate(int width, int height, int flags)
 	params.renderUpdate = glfont__renderUpdate;
 	params.renderDraw = glfont__renderDraw; 
 	params.renderDelete = glfont__renderDelete;
+	params.renderEffect = glfont__renderEffect;
 	params.userPtr = gl;
 
 	return fontCreateInternal(&params);
@@ -237,4 +380,12 @@ FONT_DEF unsigned int glfontRGBA(unsigned char r, unsigned char g, unsigned char
 	return (r) | (g << 8) | (b << 16) | (a << 24);
 }
 
+FONT_DEF void glfontSetMatrix(FONTcontext* ctx, const float* mvp)
+{
+	GLFONTcontext* gl;
+	if (ctx == NULL) return;
+	gl = (GLFONTcontext*)ctx->params.userPtr;
+	memcpy(gl->mvp, mvp, sizeof(gl->mvp));
+}
+
 #endif // GLFONTSTASH_IMPLEMENTATION
@@ -458,6 +458,13 @@ int main(int arg, char **argv)
    #define STBTT_free(x,u)    ((void)(u),free(x))
    #endif
 
+   // #define "STBTT_realloc(p,oldsize,newsize,u)" to grow buffers in place, by default it is malloc + copy + free
+   // #define "STBTT_realloc_max(p,oldsize,u)" to return the largest size STBTT_realloc can grow p to,
+   // buffers that grow on demand then do not ask for more than the allocator has
+
+   // #define "STBTT_accumulate_scanline(pixels,scanline,scanline2,w)" to replace the loop of the v2
+   // rasterizer that sums the coverage of a scanline and converts it to bytes, e.g. with SIMD
+
    #ifndef STBTT_assert
    #include <assert.h>
    #define STBTT_assert(x)    assert(x)
@@ -1857,9 +1864,48 @@ typedef struct
 
    stbtt_vertex *pvertices;
    int num_vertices;
+   int max_vertices; // capacity of pvertices, -1 after a failed allocation
+   void *userdata;
 } stbtt__csctx;
 
-#define STBTT__CSCTX_INIT(bounds) {bounds,0, 0,0, 0,0, 0,0,0,0, NULL, 0}
+#define STBTT__CSCTX_INIT(bounds) {bounds,0, 0,0, 0,0, 0,0,0,0, NULL, 0, 0, NULL}
+
+#ifndef STBTT_realloc
+static void *stbtt__realloc(void *p, size_t oldsize, size_t newsize, void *userdata)
+{
+   void *q = STBTT_malloc(newsize, userdata);
+   if (q && p) STBTT_memcpy(q, p, oldsize < newsize ? oldsize : newsize);
+   if (q) STBTT_free(p, userdata);
+   return q;
+}
+#define STBTT_realloc(p,oldsize,newsize,u) stbtt__realloc(p,oldsize,newsize,u)
+#endif
+
+#ifndef STBTT_realloc_max
+#define STBTT_realloc_max(p,oldsize,u) ((void)(p),(void)(oldsize),(void)(u),(size_t)-1)
+#endif
+
+static int stbtt__csctx_grow(stbtt__csctx *c)
+{
+   int n = c->max_vertices ? c->max_vertices * 2 : 64;
+   size_t limit;
+   stbtt_vertex *v;
+   if (c->max_vertices < 0) return 0;
+   // double the buffer, but no further than the allocator can go, and at least by one vertex
+   limit = STBTT_realloc_max(c->pvertices, c->max_vertices * sizeof(stbtt_vertex), c->userdata) / sizeof(stbtt_vertex);
+   if ((size_t)n > limit)
+      n = limit > (size_t)c->max_vertices + 1 ? (int)limit : c->max_vertices + 1;
+   v = (stbtt_vertex *) STBTT_realloc(c->pvertices, c->max_vertices * sizeof(stbtt_vertex), n * sizeof(stbtt_vertex), c->userdata);
+   if (v == NULL) {
+      STBTT_free(c->pvertices, c->userdata);
+      c->pvertices = NULL;
+      c->max_vertices = -1;
+      return 0;
+   }
+   c->pvertices = v;
+   c->max_vertices = n;
+   return 1;
+}
 
 static void stbtt__track_vertex(stbtt__csctx *c, stbtt_int32 x, stbtt_int32 y)
 {
@@ -1878,7 +1924,7 @@ static void stbtt__csctx_v(stbtt__csctx *c, stbtt_uint8 type, stbtt_int32 x, stb
          stbtt__track_vertex(c, cx, cy);
          stbtt__track_vertex(c, cx1, cy1);
       }
-   } else {
+   } else if (c->num_vertices < c->max_vertices || stbtt__csctx_grow(c)) {
       stbtt_setvertex(&c->pvertices[c->num_vertices], type, x, y, cx, cy);
       c->pvertices[c->num_vertices].cx1 = (stbtt_int16) cx1;
       c->pvertices[c->num_vertices].cy1 = (stbtt_int16) cy1;
@@ -2221,17 +2267,20 @@ static int stbtt__run_charstring(const stbtt_fontinfo *info, int glyph_index, st
 
 static int stbtt__GetGlyphShapeT2(const stbtt_fontinfo *info, int glyph_index, stbtt_vertex **pvertices)
 {
-   // runs the charstring twice, once to count and once to output (to avoid realloc)
-   stbtt__csctx count_ctx = STBTT__CSCTX_INIT(1);
+   // runs the charstring once, growing the vertex buffer as it goes
    stbtt__csctx output_ctx = STBTT__CSCTX_INIT(0);
-   if (stbtt__run_charstring(info, glyph_index, &count_ctx)) {
-      *pvertices = (stbtt_vertex*)STBTT_malloc(count_ctx.num_vertices*sizeof(stbtt_vertex), info->userdata);
-      output_ctx.pvertices = *pvertices;
-      if (stbtt__run_charstring(info, glyph_index, &output_ctx)) {
-         STBTT_assert(output_ctx.num_vertices == count_ctx.num_vertices);
-         return output_ctx.num_vertices;
+   output_ctx.userdata = info->userdata;
+   if (stbtt__run_charstring(info, glyph_index, &output_ctx) && output_ctx.max_vertices >= 0) {
+      // give the unused part of the buffer back, it would otherwise stay allocated with the shape
+      if (output_ctx.num_vertices > 0 && output_ctx.num_vertices < output_ctx.max_vertices) {
+         stbtt_vertex *v = (stbtt_vertex *) STBTT_realloc(output_ctx.pvertices, output_ctx.max_vertices * sizeof(stbtt_vertex),
+                                                          output_ctx.num_vertices * sizeof(stbtt_vertex), info->userdata);
+         if (v != NULL) output_ctx.pvertices = v;
       }
+      *pvertices = output_ctx.pvertices;
+      return output_ctx.num_vertices;
    }
+   STBTT_free(output_ctx.pvertices, info->userdata);
    *pvertices = NULL;
    return 0;
 }
@@ -3118,7 +3167,7 @@ static void stbtt__rasterize_sorted_edges(stbtt__bitmap *result, stbtt__edge *e,
 {
    stbtt__hheap hh = { 0, 0, 0 };
    stbtt__active_edge *active = NULL;
-   int y,j=0, i;
+   int y,j=0;
    float scanline_data[129], *scanline, *scanline2;
 
    STBTT__NOTUSED(vsubsample);
@@ -3180,8 +3229,12 @@ static void stbtt__rasterize_sorted_edges(stbtt__bitmap *result, stbtt__edge *e,
       if (active)
          stbtt__fill_active_edges_new(scanline, scanline2+1, result->w, active, scan_y_top);
 
+#ifdef STBTT_accumulate_scanline
+      STBTT_accumulate_scanline(result->pixels + j*result->stride, scanline, scanline2, result->w);
+#else
       {
          float sum = 0;
+         int i;
          for (i=0; i < result->w; ++i) {
             float k;
             int m;
@@ -3193,6 +3246,7 @@ static void stbtt__rasterize_sorted_edges(stbtt__bitmap *result, stbtt__edge *e,
             result->pixels[j*result->stride + i] = (unsigned char) m;
          }
       }
+#endif
       // advance all the edges
       step = &active;
       while (*step) {
@@ -0,0 +1,135 @@
+//
+// Times drawing text with the glyphs missing from the atlas (rasterized every time) and with the
+// glyphs already in the atlas, and prints a hash of the atlas and of the drawn vertices.
+// Builds with different flags (FONT_NO_SIMD, FONT_USE_FREETYPE, -DBENCH_FLAGS=FONT_SDF, ...)
+// can be compared by their timings, and draw the same if the hashes match.
+//
+//	cc -O2 -I.. bench.c -o bench -lm
+//	cc -O2 -DFONT_USE_FREETYPE -I.. -I/usr/include/freetype2 bench.c -o bench -lfreetype -lm
+//	./bench font.ttf [size blur iterations]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#define FONTSTASH_IMPLEMENTATION
+#include "fontstash.h"
+
+#ifndef BENCH_FLAGS
+#define BENCH_FLAGS 0
+#endif
+
+static const char* text[] = {
+	"The quick brown fox jumps over the lazy dog.",
+	"PACK MY BOX WITH FIVE DOZEN LIQUOR JUGS!",
+	"0123456789 (){}[]<>+-*/=%&|^~#$@?!;:,'\"",
+	"\xc3\x85ngstr\xc3\xb6m caf\xc3\xa9 na\xc3\xafve \xc3\xa6\xc3\xb8\xc3\xa5 \xc3\x9f",
+};
+#define NTEXT (int)(sizeof(text) / sizeof(text[0]))
+
+static unsigned int vertHash = 2166136261u;
+static int nverts = 0;
+
+static void hashBytes(unsigned int* h, const unsigned char* data, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		*h ^= data[i];
+		*h *= 16777619u;
+	}
+}
+
+static void renderDraw(void* uptr, const float* verts, const float* tcoords, const unsigned int* colors, int n)
+{
+	int i;
+	(void)uptr;
+	(void)colors;
+	// Hash the positions at 1/64 pixel so that float noise in the last bits does not show.
+	for (i = 0; i < n*2; i++) {
+		int v[2];
+		v[0] = (int)floorf(verts[i] * 64.0f + 0.5f);
+		v[1] = (int)floorf(tcoords[i] * 65536.0f + 0.5f);
+		hashBytes(&vertHash, (const unsigned char*)v, sizeof(v));
+	}
+	nverts += n;
+}
+
+static double seconds(clock_t t)
+{
+	return (double)t / CLOCKS_PER_SEC;
+}
+
+static int drawAll(FONTcontext* stash)
+{
+	int i, nglyphs = 0;
+	for (i = 0; i < NTEXT; i++) {
+		fontDrawText(stash, 10, 40.0f + i*40.0f, text[i], NULL);
+		nglyphs += (int)strlen(text[i]);
+	}
+	return nglyphs;
+}
+
+int main(int argc, char** argv)
+{
+	FONTparams params;
+	FONTcontext* stash;
+	float size = argc > 2 ? (float)atof(argv[2]) : 24.0f;
+	float blur = argc > 3 ? (float)atof(argv[3]) : 0.0f;
+	int iterations = argc > 4 ? atoi(argv[4]) : 200;
+	int i, font, width, height, nglyphs = 0;
+	unsigned int texHash = 2166136261u;
+	const unsigned char* data;
+	clock_t t;
+
+	if (argc < 2) {
+		printf("usage: %s font.ttf [size blur iterations]\n", argv[0]);
+		return 1;
+	}
+
+	memset(&params, 0, sizeof(params));
+	params.width = 1024;
+	params.height = 1024;
+	params.flags = FONT_ZERO_TOPLEFT | BENCH_FLAGS;
+	params.renderDraw = renderDraw;
+	stash = fontCreateInternal(&params);
+	if (stash == NULL) return 1;
+
+	font = fontAddFont(stash, "font", argv[1]);
+	if (font == FONT_INVALID) {
+		printf("cannot load %s\n", argv[1]);
+		return 1;
+	}
+	fontSetFont(stash, font);
+	fontSetSize(stash, size);
+	fontSetBlur(stash, blur);
+
+	// Rasterize all glyphs every time.
+	t = clock();
+	for (i = 0; i < iterations; i++) {
+		fontResetAtlas(stash, params.width, params.height);
+		nglyphs += drawAll(stash);
+	}
+	t = clock() - t;
+	printf("miss: %.3f us/glyph\n", seconds(t) * 1e6 / nglyphs);
+
+	// Hash what the last pass drew.
+	data = fontGetTextureData(stash, &width, &height);
+	hashBytes(&texHash, data, width * height);
+	vertHash = 2166136261u;
+	nverts = 0;
+	drawAll(stash);
+	printf("atlas %08x, %d verts %08x\n", texHash, nverts, vertHash);
+
+	// Glyphs are in the atlas.
+	nglyphs = 0;
+	t = clock();
+	for (i = 0; i < iterations * 10; i++)
+		nglyphs += drawAll(stash);
+	t = clock() - t;
+	printf("hit: %.3f us/glyph\n", seconds(t) * 1e6 / nglyphs);
+
+	fontDeleteInternal(stash);
+	return 0;
+}
@@ -0,0 +1,100 @@
+//
+// Compares the glyphs rasterized by fontstash with stbtt_MakeGlyphBitmap() of stb_truetype.
+// Up to FONT_FLATNESS_SIZE pixels the outlines are flattened the same way and the bitmaps must match.
+//
+//	cc -O2 -I.. rastertest.c -o rastertest -lm
+//	./rastertest font.ttf [minsize maxsize]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#define FONTSTASH_IMPLEMENTATION
+#include "fontstash.h"
+
+#ifdef FONT_USE_FREETYPE
+#error rastertest compares against stb_truetype, build it without FONT_USE_FREETYPE.
+#endif
+
+int main(int argc, char** argv)
+{
+	FONTparams params;
+	FONTcontext* stash;
+	FONTface* face;
+	int font, size, g, nglyphs, minSize = 8, maxSize = (int)FONT_FLATNESS_SIZE;
+	int failed = 0;
+
+	if (argc < 2) {
+		printf("usage: %s font.ttf [minsize maxsize]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 3) {
+		minSize = atoi(argv[2]);
+		maxSize = atoi(argv[3]);
+	}
+
+	memset(&params, 0, sizeof(params));
+	params.width = 256;
+	params.height = 256;
+	stash = fontCreateInternal(&params);
+	if (stash == NULL) return 1;
+	font = fontAddFont(stash, "font", argv[1]);
+	if (font == FONT_INVALID) {
+		printf("Could not load %s\n", argv[1]);
+		return 1;
+	}
+	face = stash->fonts[font]->face;
+	nglyphs = face->font.font.numGlyphs;
+
+	for (size = minSize; size <= maxSize; size++) {
+		float scale = font__tt_getPixelHeightScale(&face->font, (float)size);
+		int diffs = 0, maxDiff = 0, skipped = 0;
+		for (g = 0; g < nglyphs; g++) {
+			int advance, lsb, x0, y0, x1, y1, bx0, by0, bx1, by1, w, h, i;
+			unsigned char *a, *b;
+
+			stash->nscratch = 0;
+			font__tt_setContext(&face->font, stash);
+			if (!font__tt_buildGlyphBitmap(&face->font, g, (float)size, scale, &advance, &lsb, &x0, &y0, &x1, &y1))
+				continue;
+			stbtt_GetGlyphBitmapBox(&face->font.font, g, scale, scale, &bx0, &by0, &bx1, &by1);
+			if (x0 != bx0 || y0 != by0 || x1 != bx1 || y1 != by1) {
+				printf("%dpx glyph %d: box %d,%d,%d,%d, stb %d,%d,%d,%d\n", size, g, x0, y0, x1, y1, bx0, by0, bx1, by1);
+				failed = 1;
+				continue;
+			}
+			w = x1 - x0;
+			h = y1 - y0;
+			if (w <= 0 || h <= 0) continue;
+
+			a = (unsigned char*)calloc(w * h, 1);
+			b = (unsigned char*)calloc(w * h, 1);
+			if (a == NULL || b == NULL) return 1;
+			font__tt_renderGlyphBitmap(&face->font, a, w, h, w, scale, scale, g);
+			// Both rasterize from the scratch memory of the context.
+			stash->nscratch = 0;
+			face->font.font.userdata = stash;
+			stbtt_MakeGlyphBitmap(&face->font.font, b, w, h, w, scale, scale, g);
+			if (stash->nscratch == 0) {
+				skipped++;
+			} else {
+				for (i = 0; i < w * h; i++) {
+					int d = abs((int)a[i] - (int)b[i]);
+					if (d != 0) diffs++;
+					if (d > maxDiff) maxDiff = d;
+				}
+			}
+			free(a);
+			free(b);
+		}
+		printf("%2dpx: %d pixels differ, max difference %d", size, diffs, maxDiff);
+		if (skipped > 0) printf(", %d glyphs skipped", skipped);
+		printf("\n");
+		if (diffs > 0) failed = 1;
+	}
+
+	fontDeleteInternal(stash);
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed;
+}
@@ -0,0 +1,123 @@
+//
+// Compares the SIMD code paths picked from the target flags with the scalar code on random data.
+// The blur must match exactly. The scanline accumulation adds in a different order and may differ
+// by 1 where the coverage rounds at half way. Without SIMD the scalar code is compared with itself.
+//
+//	cc -O2 -I.. simdtest.c -o simdtest -lm
+//	cc -O2 -mavx2 -I.. simdtest.c -o simdtest -lm
+//	./simdtest [iterations]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#define FONTSTASH_IMPLEMENTATION
+#include "fontstash.h"
+
+static unsigned int seed = 1;
+
+static unsigned int rnd(void)
+{
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+// font__blur() with the scalar passes only.
+static void blurScalar(unsigned char* dst, int w, int h, int dstStride, int blur)
+{
+	float sigma = (float)blur * 0.57735f;
+	int alpha = (int)((1<<APREC) * (1.0f - expf(-2.3f / (sigma+1.0f))));
+	font__blurRowsScalar(dst, w, h, dstStride, alpha);
+	font__blurColsScalar(dst, w, h, dstStride, alpha);
+	font__blurRowsScalar(dst, w, h, dstStride, alpha);
+	font__blurColsScalar(dst, w, h, dstStride, alpha);
+}
+
+static int testBlur(int iterations)
+{
+	unsigned char* scratch = (unsigned char*)malloc(FONT_SCRATCH_BUF_SIZE);
+	unsigned char* a = (unsigned char*)malloc(300*300);
+	unsigned char* b = (unsigned char*)malloc(300*300);
+	int i, j, failed = 0;
+
+	for (i = 0; i < iterations; i++) {
+		int w = 1 + rnd() % 280, h = 1 + rnd() % 280;
+		int stride = w + rnd() % 20, blur = 1 + rnd() % 20;
+		for (j = 0; j < stride*h; j++)
+			a[j] = (rnd() % 3) == 0 ? 0 : (unsigned char)rnd();
+		memcpy(b, a, stride*h);
+		font__blur(scratch, a, w, h, stride, blur);
+		blurScalar(b, w, h, stride, blur);
+		if (memcmp(a, b, stride*h) != 0) {
+			printf("blur %dx%d stride %d blur %d differs\n", w, h, stride, blur);
+			failed++;
+		}
+	}
+
+	free(scratch);
+	free(a);
+	free(b);
+	return failed;
+}
+
+#if defined(FONT_SIMD_SSE2) || defined(FONT_SIMD_NEON)
+static int testAccumulate(int iterations)
+{
+	float scanline[512], scanline2[513];
+	unsigned char a[512], b[512];
+	int i, j, failed = 0, ndiff = 0;
+
+	for (i = 0; i < iterations; i++) {
+		int w = 1 + rnd() % 500;
+		float sum = 0;
+		for (j = 0; j < w; j++) {
+			scanline[j] = (float)(rnd() % 2001) / 1000.0f - 1.0f;
+			scanline2[j] = (float)(rnd() % 2001) / 2000.0f - 0.5f;
+		}
+		font__accumulateScanline(a, scanline, scanline2, w);
+		// The scalar loop of stb_truetype.
+		for (j = 0; j < w; j++) {
+			int m;
+			sum += scanline2[j];
+			m = (int)((float)fabs(scanline[j] + sum)*255 + 0.5f);
+			b[j] = (unsigned char)(m > 255 ? 255 : m);
+		}
+		for (j = 0; j < w; j++) {
+			int d = abs((int)a[j] - (int)b[j]);
+			if (d > 1) {
+				printf("accumulate width %d pixel %d: %d vs %d\n", w, j, a[j], b[j]);
+				failed++;
+				break;
+			}
+			ndiff += d;
+		}
+	}
+	printf("accumulate: %d pixels differ by 1\n", ndiff);
+	return failed;
+}
+#endif
+
+int main(int argc, char** argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+	int failed = 0;
+
+#if defined(FONT_SIMD_AVX2)
+	printf("simd: avx2\n");
+#elif defined(FONT_SIMD_SSE2)
+	printf("simd: sse2\n");
+#elif defined(FONT_SIMD_NEON)
+	printf("simd: neon\n");
+#else
+	printf("simd: none\n");
+#endif
+
+	failed += testBlur(iterations);
+#if defined(FONT_SIMD_SSE2) || defined(FONT_SIMD_NEON)
+	failed += testAccumulate(iterations * 10);
+#endif
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+//
+// Compares the cmap and kerning tables built by fontstash with the lookups of the font backend:
+// the glyph index of every code point, the kerning of every glyph pair from the pair cache with
+// and without FONT_FLATTEN_KERNING, and the precomputed ASCII kerning. The kerning is in font units
+// and must not depend on the sizes used before, so some text is drawn before comparing it.
+//
+//	cc -O2 -I.. tabletest.c -o tabletest -lm
+//	cc -O2 -DFONT_USE_FREETYPE -I.. -I/usr/include/freetype2 tabletest.c -o tabletest -lfreetype -lm
+//	./tabletest font.ttf [font2.ttf ...]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#define FONTSTASH_IMPLEMENTATION
+#include "fontstash.h"
+
+#ifdef FONT_USE_FREETYPE
+
+static int numGlyphs(FONTface* face)
+{
+	return (int)face->font.font->num_glyphs;
+}
+
+static int glyphIndex(FONTface* face, unsigned int codepoint)
+{
+	return (int)FT_Get_Char_Index(face->font.font, codepoint);
+}
+
+static int glyphKern(FONTface* face, int glyph1, int glyph2)
+{
+	FT_Vector kern;
+	if (FT_Get_Kerning(face->font.font, glyph1, glyph2, FT_KERNING_UNSCALED, &kern))
+		return 0;
+	return (int)kern.x;
+}
+
+#else
+
+static int numGlyphs(FONTface* face)
+{
+	return face->font.font.numGlyphs;
+}
+
+static int glyphIndex(FONTface* face, unsigned int codepoint)
+{
+	return stbtt_FindGlyphIndex(&face->font.font, (int)codepoint);
+}
+
+static int glyphKern(FONTface* face, int glyph1, int glyph2)
+{
+	return stbtt_GetGlyphKernAdvance(&face->font.font, glyph1, glyph2);
+}
+
+#endif
+
+static int testCmap(FONTface* face)
+{
+	unsigned int c;
+	int failed = 0;
+	for (c = 0; c < 0x110000; c++) {
+		int g = font__getGlyphIndex(face, c);
+		if (g != glyphIndex(face, c)) {
+			if (failed++ < 10)
+				printf("  code point %x: glyph %d vs %d\n", c, g, glyphIndex(face, c));
+		}
+	}
+	return failed;
+}
+
+static int testKerning(FONTface* face, int* nkern)
+{
+	int g1, g2, c1, c2, failed = 0;
+	int nglyphs = numGlyphs(face);
+
+	for (g1 = 0; g1 < nglyphs; g1++) {
+		for (g2 = 0; g2 < nglyphs; g2++) {
+			int kern = face->hasKerning ? font__getKern(face, g1, g2) : 0;
+			if (kern != 0) (*nkern)++;
+			if (kern != glyphKern(face, g1, g2)) {
+				if (failed++ < 10)
+					printf("  glyphs %d %d: kern %d vs %d\n", g1, g2, kern, glyphKern(face, g1, g2));
+			}
+		}
+	}
+
+	if (face->asciiKern == NULL) return failed;
+	for (c1 = 0; c1 < FONT_ASCII_KERN_COUNT; c1++) {
+		for (c2 = 0; c2 < FONT_ASCII_KERN_COUNT; c2++) {
+			int kern = face->asciiKern[c1 * FONT_ASCII_KERN_COUNT + c2];
+			g1 = glyphIndex(face, FONT_ASCII_KERN_FIRST + c1);
+			g2 = glyphIndex(face, FONT_ASCII_KERN_FIRST + c2);
+			if (kern == FONT_ASCII_KERN_NONE) {
+				if (g1 != 0 && g2 != 0) failed++;
+			} else if (kern != glyphKern(face, g1, g2)) {
+				if (failed++ < 10)
+					printf("  ascii %c%c: kern %d vs %d\n", FONT_ASCII_KERN_FIRST + c1, FONT_ASCII_KERN_FIRST + c2,
+						   kern, glyphKern(face, g1, g2));
+			}
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char** argv)
+{
+	int i, flatten, failed = 0;
+
+	if (argc < 2) {
+		printf("usage: %s font.ttf [font2.ttf ...]\n", argv[0]);
+		return 1;
+	}
+
+	for (flatten = 0; flatten < 2; flatten++) {
+		FONTparams params;
+		FONTcontext* stash;
+		memset(&params, 0, sizeof(params));
+		params.width = 256;
+		params.height = 256;
+		params.flags = flatten ? FONT_FLATTEN_KERNING : 0;
+		stash = fontCreateInternal(&params);
+		if (stash == NULL) return 1;
+
+		for (i = 1; i < argc; i++) {
+			int font = fontAddFont(stash, argv[i], argv[i]);
+			int cmap = 0, kern, nkern = 0;
+			if (font == FONT_INVALID) {
+				printf("%s: cannot load\n", argv[i]);
+				failed++;
+				continue;
+			}
+			// Kerned text at a few sizes, so that the pair cache is filled while a size is active.
+			fontSetFont(stash, font);
+			fontSetSize(stash, 13.0f);
+			fontDrawText(stash, 0, 20, "AVATAR To. Wa", NULL);
+			fontSetSize(stash, 40.0f);
+			fontDrawText(stash, 0, 60, "AVATAR To. Wa", NULL);
+			// The cmap does not depend on the flags.
+			if (!flatten)
+				cmap = testCmap(stash->fonts[font]->face);
+			kern = testKerning(stash->fonts[font]->face, &nkern);
+			printf("%s%s: %d kerning pairs, cmap %d, kerning %d mismatches\n",
+				   argv[i], flatten ? " (flattened)" : "", nkern, cmap, kern);
+			failed += cmap + kern;
+		}
+
+		fontDeleteInternal(stash);
+	}
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed ? 1 : 0;
+}